@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstring>
 #include <memory>
 
 #include "lang.h"
@@ -90,6 +91,8 @@ struct TRect2
 	T width() const { return x2 - x1; }
 	T height() const { return y2 - y1; }
 	tvec2<T> size() const { return p2 - p1; }
+
+	bool contains(const tvec2<T>& p) const { return p.x >= x1 && p.x < x2 && p.y >= y1 && p.y < y2; }
 };
 
 using Rect2 = TRect2<float>;
@@ -97,3 +100,24 @@ using Rect2i = TRect2<int>;
 using Point2 = TPoint2<float>;
 using Point2i = TPoint2<int>;
 
+// Fast non-cryptographic hash of raw memory, for detecting changed data
+//	Chain calls by passing previous result as seed
+inline uint64 hashMemory(const void* data, size_t size, uint64 seed = 0xcbf29ce484222325ull)
+{
+	const uint64 prime = 0x100000001b3ull;
+	const uint8* bytes = (const uint8*)data;
+	uint64 hash = seed;
+
+	// FNV-1a style mixing, 8 bytes at a time
+	for (; size >= sizeof(uint64); size -= sizeof(uint64), bytes += sizeof(uint64))
+	{
+		uint64 word;
+		memcpy(&word, bytes, sizeof(uint64));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+	for (; size > 0; --size, ++bytes)
+		hash = (hash ^ *bytes) * prime;
+
+	return hash;
+}
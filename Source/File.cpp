@@ -0,0 +1,163 @@
+#include "File.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#include "SDL.h"
+
+#if !defined(__WINDOWS__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define SUPPORTS_MMAP
+#else
+	#include <direct.h>
+#endif
+
+namespace jcpe
+{
+
+namespace File
+{
+
+struct MappedFile
+{
+	uint8* data;
+	size_t size;
+	// Otherwise data is heap allocated
+	bool mapped;
+};
+
+#ifdef SUPPORTS_MMAP
+static bool mapFileData(const char* path, MappedFile& file)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	SCOPE_EXIT( close(fd); );
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+		return false;
+
+	void* const data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+
+	file.data = (uint8*)data;
+	file.size = (size_t)fileStat.st_size;
+	file.mapped = true;
+	return true;
+}
+#endif
+
+static bool readFileData(const char* path, MappedFile& file)
+{
+	SDL_RWops* rw = SDL_RWFromFile(path, "rb");
+	if (!rw)
+		return false;
+
+	SCOPE_EXIT( SDL_RWclose(rw); );
+
+	const Sint64 size = SDL_RWsize(rw);
+	if (size <= 0)
+		return false;
+
+	uint8* const data = (uint8*)malloc((size_t)size);
+	if (SDL_RWread(rw, data, (size_t)size, 1) != 1)
+	{
+		free(data);
+		return false;
+	}
+
+	file.data = data;
+	file.size = (size_t)size;
+	file.mapped = false;
+	return true;
+}
+
+owned_ptr<MappedFile> mapFile(const char* path)
+{
+	MappedFile file;
+#ifdef SUPPORTS_MMAP
+	if (!mapFileData(path, file) && !readFileData(path, file))
+		return nullptr;
+#else
+	if (!readFileData(path, file))
+		return nullptr;
+#endif
+
+	return owned_ptr<MappedFile>(new MappedFile(file));
+}
+
+void unmapFile(owned_ptr<MappedFile> file)
+{
+	MappedFile* filePtr = file.release();
+#ifdef SUPPORTS_MMAP
+	if (filePtr->mapped)
+		munmap(filePtr->data, filePtr->size);
+	else
+		free(filePtr->data);
+#else
+	free(filePtr->data);
+#endif
+
+	delete(filePtr);
+}
+
+span<const uint8> getMappedFileData(not_null<const MappedFile*> file)
+{
+	return span<const uint8>(file->data, (std::ptrdiff_t)file->size);
+}
+
+bool writeFile(const char* path, const void* data, size_t size)
+{
+	const string tempPath = string(path) + ".tmp";
+	SDL_RWops* rw = SDL_RWFromFile(tempPath.c_str(), "wb");
+	if (!rw)
+		return false;
+
+	const bool written = SDL_RWwrite(rw, data, size, 1) == 1;
+	if (SDL_RWclose(rw) != 0 || !written)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	// Rename does not replace existing files on all platforms
+	std::remove(path);
+	if (std::rename(tempPath.c_str(), path) != 0)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool createDirectory(const char* path)
+{
+#if !defined(__WINDOWS__)
+	const int result = mkdir(path, 0755);
+#else
+	const int result = _mkdir(path);
+#endif
+	return result == 0 || errno == EEXIST;
+}
+
+string getPreferencesPath()
+{
+	char* path = SDL_GetPrefPath("jcpe", "sdl2-testgame");
+	if (!path)
+		return string();
+
+	const string result(path);
+	SDL_free(path);
+	return result;
+}
+
+}
+
+}
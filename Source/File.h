@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Core.h"
+
+namespace jcpe
+{
+
+namespace File
+{
+	struct MappedFile;
+
+	// Read-only view of a whole file, memory-mapped where supported, read into memory otherwise
+	//	Returns null if the file can not be opened
+	owned_ptr<MappedFile> mapFile(const char* path);
+	void unmapFile(owned_ptr<MappedFile> file);
+
+	span<const uint8> getMappedFileData(not_null<const MappedFile*> file);
+
+	// Writes to a temporary file that replaces path when complete
+	bool writeFile(const char* path, const void* data, size_t size);
+
+	// True if the directory exists afterwards, parent directory has to exist
+	bool createDirectory(const char* path);
+
+	// Per-user writable directory for caches and settings, ends with a path separator
+	//	Empty if not available
+	string getPreferencesPath();
+}
+
+}
@@ -0,0 +1,159 @@
+#include "FrameTimeGraph.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+
+#include "Profiler.h"
+#include "IMGui.h"
+#include "ColorDefines.h"
+
+namespace jcpe
+{
+
+namespace frameTimeGraph
+{
+	// Frame times kept for graph and histogram
+	static const uint kFrameCount = 240;
+	static const uint kBucketCount = 24;
+	// Frame time mapped to full graph height, also histogram range
+	static const float kMaxFrameTimeMs = 50.0f;
+	static const float kBarWidth = 2.0f;
+	static const float kHistogramWidthFraction = 0.3f;
+	static const float kLabelHeight = 16.0f;
+
+	static uint toBucket(float ms)
+	{
+		const uint bucket = (uint)(ms * (kBucketCount / kMaxFrameTimeMs));
+		return std::min(bucket, kBucketCount - 1);
+	}
+}
+
+struct FrameTimeGraph::State
+{
+	// Ring buffer of root sample durations
+	array<float, frameTimeGraph::kFrameCount> frameTimesMs;
+	uint frameTimeCount = 0;
+	uint nextWriteIndex = 0;
+	uint64 nextFrameNumber = 0;
+
+	// Updated incrementally as frames enter and leave the ring
+	array<uint, frameTimeGraph::kBucketCount> histogram = {};
+};
+
+
+unique_ptr<FrameTimeGraph> FrameTimeGraph::create()
+{
+	void* const baseAddr = malloc(sizeof(FrameTimeGraph) + sizeof(State));
+	void* const stateAddr = (void*)((uint8*)baseAddr + sizeof(FrameTimeGraph));
+
+	auto* state = new (stateAddr) State();
+	auto* obj = new (baseAddr) FrameTimeGraph(state);
+	return unique_ptr<FrameTimeGraph>(obj);
+}
+
+FrameTimeGraph::FrameTimeGraph(State* state)
+	: m_state(state)
+{
+}
+
+FrameTimeGraph::~FrameTimeGraph()
+{
+	m_state->~State();
+}
+
+void FrameTimeGraph::update()
+{
+	using namespace frameTimeGraph;
+
+	State& state = *m_state;
+	const auto profiler = Profiler::getProfiler();
+	const uint64 frameCount = profiler->getFrameCount();
+
+	// Only visit frames completed since last update
+	for (uint64 frameNumber = std::max(state.nextFrameNumber, profiler->getOldestFrameNumber()); 
+			frameNumber < frameCount; ++frameNumber)
+	{
+		const auto frameData = profiler->getFrameData(frameNumber);
+		const float ms = std::chrono::duration<float, std::milli>(frameData->samples[0].duration).count();
+
+		float& slot = state.frameTimesMs[state.nextWriteIndex];
+		if (state.frameTimeCount == kFrameCount)
+			--state.histogram[toBucket(slot)];
+		else
+			++state.frameTimeCount;
+
+		slot = ms;
+		++state.histogram[toBucket(ms)];
+		state.nextWriteIndex = (state.nextWriteIndex + 1) % kFrameCount;
+	}
+	state.nextFrameNumber = frameCount;
+}
+
+void FrameTimeGraph::draw(not_null<IMGui*> gui, const Rect2& area)
+{
+	PROFILER_SCOPE("FrameTimeGraphDraw", &Profiler::kProfilerCategoryProfiler);
+
+	using namespace frameTimeGraph;
+
+	update();
+
+	const State& state = *m_state;
+
+	gui->filledRect(area, Color32(0,0,0,0.5f));
+
+	const float histogramWidth = area.width() * kHistogramWidthFraction;
+	const Rect2 graphRect = Rect2(area.x, area.y + kLabelHeight, area.width() - histogramWidth, area.height() - kLabelHeight);
+	const Rect2 histogramRect = Rect2(graphRect.x2, graphRect.y, histogramWidth, graphRect.height());
+	const float msToPixels = graphRect.height() / kMaxFrameTimeMs;
+
+	// Graph, newest frame to the right
+	const uint barCount = std::min(state.frameTimeCount, (uint)(graphRect.width() / kBarWidth));
+	float maxMs = 0;
+	float sumMs = 0;
+	for (uint i = 0; i < barCount; ++i)
+	{
+		const uint index = (state.nextWriteIndex + kFrameCount - 1 - i) % kFrameCount;
+		const float ms = state.frameTimesMs[index];
+		const float height = std::min(ms * msToPixels, graphRect.height());
+		const float x = graphRect.x2 - (i + 1) * kBarWidth;
+		gui->filledRect(Rect2(x, graphRect.y2 - height, kBarWidth, height), Profiler::frameTimeColor(ms));
+
+		maxMs = std::max(maxMs, ms);
+		sumMs += ms;
+	}
+
+	for (float budgetMs : Profiler::kFrameBudgetMs)
+	{
+		const float y = graphRect.y2 - budgetMs * msToPixels;
+		gui->filledRect(Rect2(graphRect.x, y, graphRect.width(), 1.0f), Color32(1,1,1,0.6f));
+	}
+
+	// Histogram, bucket frame time on y axis to line up with graph
+	uint maxBucketCount = 1;
+	for (uint count : state.histogram)
+		maxBucketCount = std::max(maxBucketCount, count);
+
+	const float bucketHeight = histogramRect.height() / kBucketCount;
+	for (uint bucket = 0; bucket < kBucketCount; ++bucket)
+	{
+		const uint count = state.histogram[bucket];
+		if (count == 0)
+			continue;
+
+		const float bucketMs = (bucket + 0.5f) * (kMaxFrameTimeMs / kBucketCount);
+		const float width = (count / (float)maxBucketCount) * histogramRect.width();
+		const float y = histogramRect.y2 - (bucket + 1) * bucketHeight;
+		gui->filledRect(Rect2(histogramRect.x, y, width, math::max(bucketHeight - 1.0f, 1.0f)), Profiler::frameTimeColor(bucketMs));
+	}
+
+	if (barCount > 0)
+	{
+		char label[64];
+		snprintf(label, array_size(label), "avg %.1f ms, max %.1f ms", sumMs / barCount, maxMs);
+		gui->text(Rect2(area.x, area.y, area.width(), kLabelHeight), label, Color::kWhite);
+	}
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Core.h"
+
+namespace jcpe
+{
+
+class IMGui;
+
+// Cheap always-on view of frame pacing
+//	Scrolling frame time graph with budget lines, and a histogram of recent frame times
+class FrameTimeGraph
+{
+public:
+	static unique_ptr<FrameTimeGraph> create();
+	~FrameTimeGraph();
+
+	void draw(not_null<IMGui*> gui, const Rect2& area);
+
+private:
+	struct State;	
+	FrameTimeGraph(State* state);
+
+	void update();
+
+	State* m_state;
+};
+
+
+}
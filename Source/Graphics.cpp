@@ -3,10 +3,15 @@
 #include "SDL.h"
 
 #include "Core.h"
+#include "File.h"
 #include "Profiler.h"
 
 #include "ColorDefines.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+
 #if defined(__IPHONEOS__) || defined(__ANDROID__)
 	#define SUPPORTS_OPENGLES
 #endif
@@ -25,6 +30,14 @@
     #endif
 #endif
 
+#if defined(GL_PROGRAM_BINARY_RETRIEVABLE_HINT)
+	#define SUPPORTS_PROGRAM_BINARY
+#endif
+
+#if defined(GL_TIMESTAMP)
+	#define SUPPORTS_TIMER_QUERY
+#endif
+
 namespace jcpe
 {
 
@@ -43,6 +56,8 @@ static AttributeTypeInfo s_attributeTypeInfos[] =
 	{ 	
 		{ GL_FLOAT, GL_FALSE }, 			// AttributeType::Float
 		{ GL_UNSIGNED_BYTE, GL_TRUE }, 		// AttributeType::NormalizedUByte
+		{ GL_SHORT, GL_FALSE }, 			// AttributeType::Int16
+		{ GL_UNSIGNED_SHORT, GL_TRUE }, 	// AttributeType::NormalizedUInt16
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,6 +79,180 @@ struct Program
 	GLuint programHandle;
 };
 
+struct StreamBuffer
+{
+	struct FencedRange
+	{
+		GLsync fence;
+		uint begin;
+		uint end;
+	};
+
+	GLuint handle;
+	GLenum target;
+	uint capacity;
+	// Drivers may reuse the name of the deleted storage when growing, so the name alone does not tell
+	uint storageGeneration;
+
+	// Whole buffer, when persistently mapped
+	uint8* persistentData;
+
+	uint head;
+	uint reservedOffset;
+	uint reservedSize;
+	void* reservedData;
+
+	// Committed since last fence, may have wrapped around
+	bool hasPending;
+	uint pendingBegin;
+
+	// Oldest first
+	std::deque<FencedRange> fencedRanges;
+};
+
+struct Capabilities
+{
+	bool bufferStorage;
+	bool programBinary;
+	bool timerQuery;
+};
+
+static Capabilities s_capabilities;
+
+// Linked programs are cached per source and driver, so startup only compiles after a change to either
+struct ProgramCache
+{
+	// Ends with a path separator, empty if not caching
+	string directory;
+	// Hash of vendor, renderer and version strings
+	uint64 driverHash;
+};
+
+static ProgramCache s_programCache;
+
+static const char* const kProgramCacheDirectoryName = "ProgramCache";
+static const uint32 kProgramCacheMagic = 0x43505247; // "GRPC"
+static const uint32 kProgramCacheVersion = 1;
+
+// Followed by the program binary
+struct ProgramCacheHeader
+{
+	uint32 magic;
+	uint32 version;
+	uint64 key;
+	uint32 binaryFormat;
+	uint32 binarySize;
+	// Time compiling and linking took, to report what loading saves
+	int64 compileMicroseconds;
+};
+
+// Last value set through this module, unknown until first set
+template<typename T>
+struct CachedState
+{
+	T value;
+	bool known = false;
+};
+
+// Shadow of the GL state set through this module, calls that would not change it are skipped
+//	Anything changing this state has to go through this module, or invalidate the cache
+struct StateCache
+{
+	static const uint kTextureChannelCount = 16;
+
+	CachedState<BlendMode> blendMode;
+	CachedState<DepthTestMode> depthTestMode;
+	CachedState<DepthWriteMode> depthWriteMode;
+	CachedState<CullMode> cullMode;
+	CachedState<ClipMode> clipMode;
+	// Scissor box as x, y, width, height
+	CachedState<vec4i> clipArea;
+	CachedState<GLuint> program;
+	CachedState<GLuint> vertexArray;
+	CachedState<GLuint> activeChannel;
+	CachedState<GLuint> textures[kTextureChannelCount];
+
+	// Since last swap
+	uint issuedCallCount = 0;
+	uint skippedCallCount = 0;
+
+	// Checks cache against glGet after every state call, debug builds only
+	bool validate = false;
+};
+
+static StateCache s_stateCache;
+
+static void validateStateCache();
+
+// Timestamp pairs rather than elapsed time queries, since those can not nest
+struct GpuScope
+{
+	const Profiler::SampleInfo* info;
+	GLuint beginQuery;
+	GLuint endQuery;
+	int childCount;
+	int descendantCount;
+};
+
+struct GpuProfilerFrame
+{
+	// Preorder, like profiler samples
+	vector<GpuScope> scopes;
+	// Issued last, results become available in order
+	GLuint lastQuery;
+	// Taken together at the first scope, maps GPU timestamps onto the profiler timeline
+	GLint64 gpuReferenceTime;
+	Profiler::TimeStamp cpuReferenceTime;
+	// Profiler frame current at the first scope, samples are filed into it once read back
+	uint64 profilerFrameNumber;
+};
+
+// Frames are read back this many swaps late at most, older frames are dropped rather than waited for
+static const uint kGpuProfilerFrameCount = 4;
+
+struct GpuProfiler
+{
+	GpuProfilerFrame frames[kGpuProfilerFrameCount];
+	// Frame scopes are recorded into, and oldest frame not yet read back
+	uint64 frameNumber = 0;
+	uint64 resolvedFrameNumber = 0;
+
+	vector<uint> scopeStack;
+	vector<GLuint> freeQueries;
+	vector<Profiler::Sample> samples;
+
+	// Registered with the first results, outlives contexts
+	bool laneRegistered = false;
+	uint lane = 0;
+};
+
+static GpuProfiler s_gpuProfiler;
+
+static void resetGpuProfiler();
+
+// Returns true if the GL call has to be issued, and caches the new value
+template<typename T>
+static bool updateCachedState(CachedState<T>& state, const T& value)
+{
+	if (state.known && state.value == value)
+	{
+		++s_stateCache.skippedCallCount;
+		return false;
+	}
+
+	state.value = value;
+	state.known = true;
+	++s_stateCache.issuedCallCount;
+	return true;
+}
+
+void invalidateStateCache()
+{
+	const bool validate = s_stateCache.validate;
+	s_stateCache = StateCache();
+	s_stateCache.validate = validate;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 owned_ptr<Window> createWindow(const WindowCreationParams& params)
@@ -123,7 +312,7 @@ owned_ptr<Context> createContext(not_null<Window*> window)
 {
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	SDL_GL_SetSwapInterval(1);
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
@@ -144,7 +333,7 @@ owned_ptr<Context> createContext(not_null<Window*> window)
             return nullptr;
         }
 
-		if (!GLEW_VERSION_3_2)
+		if (!GLEW_VERSION_3_3)
 		{
             LOG("Could not create context. Incompatible OpenGL version: " << glVersionDesc);
 			SDL_GL_DeleteContext(sdlc);
@@ -153,7 +342,62 @@ owned_ptr<Context> createContext(not_null<Window*> window)
     }
     #endif
 
+	#if defined(USING_GLEW) && defined(GL_MAP_PERSISTENT_BIT)
+		s_capabilities.bufferStorage = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	#else
+		s_capabilities.bufferStorage = false;
+	#endif
+
+	// State of a new context is not known to the cache
+	invalidateStateCache();
+
+	// Timestamps are core, but may be implemented without any counter bits
+	s_capabilities.timerQuery = false;
+	#if defined(SUPPORTS_TIMER_QUERY)
+	{
+		GLint counterBits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counterBits);
+		s_capabilities.timerQuery = counterBits > 0;
+	}
+	#endif
+	resetGpuProfiler();
+
+	// Drivers may support binaries without supporting any format
+	s_capabilities.programBinary = false;
+	#if defined(SUPPORTS_PROGRAM_BINARY)
+	{
+		#if defined(USING_GLEW)
+			const bool programBinaryExtension = GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary;
+		#else
+			const bool programBinaryExtension = true;
+		#endif
+		GLint formatCount = 0;
+		if (programBinaryExtension)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		s_capabilities.programBinary = formatCount > 0;
+	}
+	#endif
+
+	s_programCache.directory.clear();
+	const string preferencesPath = File::getPreferencesPath();
+	if (s_capabilities.programBinary && !preferencesPath.empty())
+	{
+		const string directory = preferencesPath + kProgramCacheDirectoryName;
+		if (File::createDirectory(directory.c_str()))
+			s_programCache.directory = directory + "/";
+		else
+			LOG("Could not create program cache directory " << directory);
+
+		const char* const vendorDesc = (const char*)glGetString(GL_VENDOR);
+		uint64 driverHash = hashMemory(vendorDesc, strlen(vendorDesc));
+		driverHash = hashMemory(rendererDesc, strlen(rendererDesc), driverHash);
+		s_programCache.driverHash = hashMemory(glVersionDesc, strlen(glVersionDesc), driverHash);
+	}
+
 	LOG("Created context with renderer: " << rendererDesc << ", OpenGL version: " << glVersionDesc); 
+	LOG("Persistently mapped stream buffers: " << (s_capabilities.bufferStorage ? "yes" : "no"));
+	LOG("Program binary cache: " << (s_programCache.directory.empty() ? "no" : s_programCache.directory.c_str()));
+	LOG("GPU timer queries: " << (s_capabilities.timerQuery ? "yes" : "no"));
 
 	Context* context = new Context{ sdlc };
 	return owned_ptr<Context>(context);
@@ -167,6 +411,17 @@ void destroyContext(owned_ptr<Context> context)
 	delete(contextptr);
 }
 
+void makeContextCurrent(not_null<Window*> window, not_null<Context*> context)
+{
+	if (SDL_GL_MakeCurrent(window->sdlWindow, context->sdlContext) != 0)
+		FATAL_ASSERT_DESC(false, string("Could not make context current: ") + SDL_GetError());
+}
+
+void releaseContextCurrent(not_null<Window*> window)
+{
+	SDL_GL_MakeCurrent(window->sdlWindow, nullptr);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static GLuint loadShader(const char *shaderSrc, GLenum type)
@@ -197,20 +452,38 @@ static GLuint loadShader(const char *shaderSrc, GLenum type)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-owned_ptr<Program> createProgram(const ProgramCreationParams& params)
+static int64 toMicroseconds(const Profiler::Duration& duration)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+static Profiler::Duration fromNanoseconds(int64 nanoseconds)
+{
+	return std::chrono::duration_cast<Profiler::Duration>(std::chrono::nanoseconds(nanoseconds));
+}
+
+// Returns zero on failure
+static GLuint compileProgram(const ProgramCreationParams& params, bool retrievable)
 {
 	// Load the vertex/fragment shaders
 	const GLuint vertexShader = loadShader(params.vertexSource, GL_VERTEX_SHADER);
 	const GLuint fragmentShader = loadShader(params.fragmentSource, GL_FRAGMENT_SHADER);
 
 	if (!vertexShader || !fragmentShader)
-		return nullptr;
+		return 0;
 
 	// Create the program object
 	GLuint programObject = glCreateProgram();
 
 	if(programObject == 0)
-		return nullptr;
+		return 0;
+
+	#if defined(SUPPORTS_PROGRAM_BINARY)
+		if (retrievable)
+			glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	#else
+		(void)retrievable;
+	#endif
 
 	glAttachShader(programObject, vertexShader);
 	glAttachShader(programObject, fragmentShader);
@@ -234,7 +507,138 @@ owned_ptr<Program> createProgram(const ProgramCreationParams& params)
 		LOG("Error linking program: " << buffer);
 
 		glDeleteProgram(programObject);
-		return nullptr;
+		return 0;
+	}
+
+	return programObject;
+}
+
+static string programCachePath(uint64 key)
+{
+	char fileName[32];
+	snprintf(fileName, array_size(fileName), "%016llx.bin", (unsigned long long)key);
+	return s_programCache.directory + fileName;
+}
+
+// Returns zero if missing, stale or rejected by the driver
+static GLuint loadProgramBinary(const char* path, uint64 key, int64* compileMicroseconds)
+{
+	#if defined(SUPPORTS_PROGRAM_BINARY)
+		owned_ptr<File::MappedFile> file = File::mapFile(path);
+		if (!file)
+			return 0;
+
+		SCOPE_EXIT( File::unmapFile(std::move(file)); );
+
+		const span<const uint8> data = File::getMappedFileData(file.get());
+		ProgramCacheHeader header;
+		if ((size_t)data.size() < sizeof(header))
+			return 0;
+
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.magic != kProgramCacheMagic || header.version != kProgramCacheVersion || header.key != key ||
+				(size_t)data.size() != sizeof(header) + header.binarySize)
+			return 0;
+
+		const GLuint programObject = glCreateProgram();
+		if (programObject == 0)
+			return 0;
+
+		glProgramBinary(programObject, (GLenum)header.binaryFormat, data.data() + sizeof(header), (GLsizei)header.binarySize);
+
+		// Drivers may reject binaries of their earlier versions even with matching version strings
+		GLint linked;
+		glGetProgramiv(programObject, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+		{
+			LOG("Program binary cache " << path << " rejected by driver, compiling");
+			glDeleteProgram(programObject);
+			return 0;
+		}
+
+		*compileMicroseconds = header.compileMicroseconds;
+		return programObject;
+	#else
+		(void)path;
+		(void)key;
+		(void)compileMicroseconds;
+		return 0;
+	#endif
+}
+
+static bool saveProgramBinary(const char* path, uint64 key, GLuint programObject, int64 compileMicroseconds)
+{
+	#if defined(SUPPORTS_PROGRAM_BINARY)
+		GLint binarySize = 0;
+		glGetProgramiv(programObject, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+		if (binarySize <= 0)
+			return false;
+
+		ProgramCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = kProgramCacheMagic;
+		header.version = kProgramCacheVersion;
+		header.key = key;
+		header.compileMicroseconds = compileMicroseconds;
+
+		vector<uint8> data(sizeof(header) + binarySize);
+		GLsizei writtenSize = 0;
+		GLenum binaryFormat = 0;
+		glGetProgramBinary(programObject, binarySize, &writtenSize, &binaryFormat, data.data() + sizeof(header));
+		if (writtenSize <= 0)
+			return false;
+
+		header.binaryFormat = binaryFormat;
+		header.binarySize = writtenSize;
+		memcpy(data.data(), &header, sizeof(header));
+		return File::writeFile(path, data.data(), sizeof(header) + writtenSize);
+	#else
+		(void)path;
+		(void)key;
+		(void)programObject;
+		(void)compileMicroseconds;
+		return false;
+	#endif
+}
+
+owned_ptr<Program> createProgram(const ProgramCreationParams& params)
+{
+	PROFILER_SCOPE("CreateProgram", &kProfilerCategoryGraphics);
+
+	const auto startTime = Profiler::getTime();
+
+	// Sources are hashed in full, as is the driver, so any change to either compiles again
+	string cachePath;
+	uint64 key = 0;
+	if (!s_programCache.directory.empty())
+	{
+		const char* const vertexSource = params.vertexSource.get();
+		const char* const fragmentSource = params.fragmentSource.get();
+		key = hashMemory(vertexSource, strlen(vertexSource) + 1, s_programCache.driverHash);
+		key = hashMemory(fragmentSource, strlen(fragmentSource) + 1, key);
+		cachePath = programCachePath(key);
+	}
+
+	int64 compileMicroseconds;
+	GLuint programObject = cachePath.empty() ? 0 : loadProgramBinary(cachePath.c_str(), key, &compileMicroseconds);
+	if (programObject)
+	{
+		const int64 loadMicroseconds = toMicroseconds(Profiler::getTime() - startTime);
+		PROFILER_COUNTER_ADD("GLProgramCreateUs", loadMicroseconds);
+		PROFILER_COUNTER_ADD("GLProgramCacheSavedUs", compileMicroseconds - loadMicroseconds);
+		LOG("Loaded program binary in " << loadMicroseconds << " us, compiling took " << compileMicroseconds << " us");
+	}
+	else
+	{
+		programObject = compileProgram(params, !cachePath.empty());
+		if (!programObject)
+			return nullptr;
+
+		compileMicroseconds = toMicroseconds(Profiler::getTime() - startTime);
+		PROFILER_COUNTER_ADD("GLProgramCreateUs", compileMicroseconds);
+
+		if (!cachePath.empty() && !saveProgramBinary(cachePath.c_str(), key, programObject, compileMicroseconds))
+			LOG("Could not write program binary cache to " << cachePath);
 	}
 
 	Program* program = new Program { programObject };
@@ -246,6 +650,10 @@ void destroyProgram(owned_ptr<Program> program)
 	Program* programPtr = program.release();
     glDeleteProgram(programPtr->programHandle);
 
+	// Stays in use until another program is bound, and its name may be reused once it is not
+	if (s_stateCache.program.known && s_stateCache.program.value == programPtr->programHandle)
+		s_stateCache.program.known = false;
+
 	delete(programPtr);
 }
 
@@ -301,6 +709,245 @@ void unmapIndexBufferData()
 	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
 }
 
+void uploadStaticVertexBufferData(const BufferHandle& buffer, not_null<const void*> data, const uint size)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+}
+
+void bindIndexBuffer(const BufferHandle& buffer)
+{
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint alignUp(uint value, uint alignment)
+{
+	return ((value + alignment - 1) / alignment) * alignment;
+}
+
+static void allocateStreamBufferStorage(StreamBuffer& streamBuffer)
+{
+	glGenBuffers(1, &streamBuffer.handle);
+	glBindBuffer(streamBuffer.target, streamBuffer.handle);
+	streamBuffer.persistentData = nullptr;
+	++streamBuffer.storageGeneration;
+
+	#if defined(GL_MAP_PERSISTENT_BIT)
+	if (s_capabilities.bufferStorage)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(streamBuffer.target, streamBuffer.capacity, NULL, flags);
+		streamBuffer.persistentData = (uint8*)glMapBufferRange(streamBuffer.target, 0, streamBuffer.capacity, flags);
+		FATAL_ASSERT_DESC(streamBuffer.persistentData, "Could not map stream buffer");
+		return;
+	}
+	#endif
+
+	glBufferData(streamBuffer.target, streamBuffer.capacity, NULL, GL_STREAM_DRAW);
+}
+
+static void releaseStreamBufferStorage(StreamBuffer& streamBuffer)
+{
+	for (const auto& range : streamBuffer.fencedRanges)
+		glDeleteSync(range.fence);
+	streamBuffer.fencedRanges.clear();
+
+	// Deleting the buffer implicitly unmaps it
+	glDeleteBuffers(1, &streamBuffer.handle);
+	streamBuffer.persistentData = nullptr;
+}
+
+// Waits until no draw in flight reads from range
+static void waitForStreamBufferRange(StreamBuffer& streamBuffer, uint begin, uint end)
+{
+	auto& fencedRanges = streamBuffer.fencedRanges;
+
+	// GPU completes fences in order, so only need to wait for the newest overlapping one
+	int lastOverlapping = -1;
+	for (int i = 0; i < (int)fencedRanges.size(); ++i)
+	{
+		const auto& range = fencedRanges[i];
+		if (range.begin < end && begin < range.end)
+			lastOverlapping = i;
+	}
+
+	if (lastOverlapping < 0)
+		return;
+
+	PROFILER_SCOPE("WaitForStreamBuffer", &kProfilerCategoryGraphics);
+	const GLenum result = glClientWaitSync(fencedRanges[lastOverlapping].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	ASSERT_DESC(result != GL_WAIT_FAILED, "Waiting for stream buffer fence failed");
+
+	for (int i = 0; i <= lastOverlapping; ++i)
+	{
+		glDeleteSync(fencedRanges.front().fence);
+		fencedRanges.pop_front();
+	}
+}
+
+static bool overlapsPendingStreamBufferData(const StreamBuffer& streamBuffer, uint begin, uint end)
+{
+	if (!streamBuffer.hasPending)
+		return false;
+	if (streamBuffer.pendingBegin <= streamBuffer.head)
+		return streamBuffer.pendingBegin < end && begin < streamBuffer.head;
+	// Pending data has wrapped around
+	return begin < streamBuffer.head || end > streamBuffer.pendingBegin;
+}
+
+owned_ptr<StreamBuffer> createStreamBuffer(const BufferTarget& target, uint capacity)
+{
+	static const GLenum targets[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER };
+
+	StreamBuffer* streamBuffer = new StreamBuffer();
+	streamBuffer->target = targets[(int)target];
+	streamBuffer->capacity = capacity;
+	streamBuffer->storageGeneration = 0;
+	streamBuffer->head = 0;
+	streamBuffer->reservedData = nullptr;
+	streamBuffer->hasPending = false;
+	allocateStreamBufferStorage(*streamBuffer);
+
+	return owned_ptr<StreamBuffer>(streamBuffer);
+}
+
+void destroyStreamBuffer(owned_ptr<StreamBuffer> streamBuffer)
+{
+	StreamBuffer* streamBufferPtr = streamBuffer.release();
+	releaseStreamBufferStorage(*streamBufferPtr);
+
+	delete(streamBufferPtr);
+}
+
+BufferHandle getStreamBufferHandle(not_null<const StreamBuffer*> streamBuffer)
+{
+	return BufferHandle(streamBuffer->handle);
+}
+
+uint getStreamBufferGeneration(not_null<const StreamBuffer*> streamBuffer)
+{
+	return streamBuffer->storageGeneration;
+}
+
+not_null<void*> reserveStreamBufferData(not_null<StreamBuffer*> streamBuffer, uint size, uint alignment)
+{
+	ASSERT_DESC(!streamBuffer->reservedData, "Stream buffer already has an open reservation");
+
+	// Keep room for at least two reservations of this size, so frames can overlap
+	if (size > streamBuffer->capacity / 2)
+	{
+		ASSERT_DESC(!streamBuffer->hasPending, "Stream buffer has to grow while holding unfenced data");
+		releaseStreamBufferStorage(*streamBuffer);
+		streamBuffer->capacity = alignUp(size, alignment) * 3;
+		streamBuffer->head = 0;
+		allocateStreamBufferStorage(*streamBuffer);
+		LOG("Growing stream buffer to " << streamBuffer->capacity << " bytes");
+	}
+
+	uint offset = alignUp(streamBuffer->head, alignment);
+	if (offset + size > streamBuffer->capacity)
+		offset = 0;
+
+	ASSERT_DESC(!overlapsPendingStreamBufferData(*streamBuffer, offset, offset + size), 
+			"Stream buffer is too small for the data of a single frame");
+	waitForStreamBufferRange(*streamBuffer, offset, offset + size);
+
+	streamBuffer->reservedOffset = offset;
+	streamBuffer->reservedSize = size;
+	if (streamBuffer->persistentData)
+	{
+		streamBuffer->reservedData = streamBuffer->persistentData + offset;
+	}
+	else
+	{
+		// Synchronization is handled by fences
+		glBindBuffer(streamBuffer->target, streamBuffer->handle);
+		streamBuffer->reservedData = glMapBufferRange(streamBuffer->target, offset, size, 
+				GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+		FATAL_ASSERT_DESC(streamBuffer->reservedData, "Could not map stream buffer");
+	}
+
+	return streamBuffer->reservedData;
+}
+
+uint commitStreamBufferData(not_null<StreamBuffer*> streamBuffer, uint usedSize)
+{
+	ASSERT_DESC(streamBuffer->reservedData, "Stream buffer has no open reservation");
+	ASSERT(usedSize <= streamBuffer->reservedSize);
+
+	const uint offset = streamBuffer->reservedOffset;
+	if (!streamBuffer->persistentData)
+	{
+		glBindBuffer(streamBuffer->target, streamBuffer->handle);
+		if (usedSize > 0)
+			glFlushMappedBufferRange(streamBuffer->target, 0, usedSize);
+		glUnmapBuffer(streamBuffer->target);
+	}
+	streamBuffer->reservedData = nullptr;
+
+	if (usedSize > 0)
+	{
+		if (!streamBuffer->hasPending)
+		{
+			streamBuffer->hasPending = true;
+			streamBuffer->pendingBegin = offset;
+		}
+		streamBuffer->head = offset + usedSize;
+	}
+
+	return offset;
+}
+
+// Drops fences the GPU has passed, so repeated fencing of retained data does not pile up
+static void releaseSignaledStreamBufferFences(StreamBuffer& streamBuffer)
+{
+	auto& fencedRanges = streamBuffer.fencedRanges;
+	while (fencedRanges.size() > 0)
+	{
+		const GLenum result = glClientWaitSync(fencedRanges.front().fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			break;
+		glDeleteSync(fencedRanges.front().fence);
+		fencedRanges.pop_front();
+	}
+}
+
+void fenceStreamBufferData(not_null<StreamBuffer*> streamBuffer)
+{
+	if (!streamBuffer->hasPending)
+		return;
+
+	const uint begin = streamBuffer->pendingBegin;
+	const uint end = streamBuffer->head;
+	auto& fencedRanges = streamBuffer->fencedRanges;
+	if (begin < end)
+	{
+		fencedRanges.push_back(StreamBuffer::FencedRange{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), begin, end });
+	}
+	else
+	{
+		// Wrapped around, fence both parts
+		fencedRanges.push_back(StreamBuffer::FencedRange{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), begin, streamBuffer->capacity });
+		fencedRanges.push_back(StreamBuffer::FencedRange{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), 0, end });
+	}
+
+	streamBuffer->hasPending = false;
+}
+
+void fenceStreamBufferRange(not_null<StreamBuffer*> streamBuffer, uint offset, uint size)
+{
+	ASSERT(offset + size <= streamBuffer->capacity);
+	if (size == 0)
+		return;
+
+	releaseSignaledStreamBufferFences(*streamBuffer);
+	streamBuffer->fencedRanges.push_back(StreamBuffer::FencedRange{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), offset, offset + size });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 AttributeBindingsHandle createAttributeBindings()
 {
 	GLuint handle;
@@ -311,11 +958,19 @@ AttributeBindingsHandle createAttributeBindings()
 void destroyAttributeBindings(const AttributeBindingsHandle& attributeBindings)
 {
 	glDeleteVertexArrays(1, (const GLuint*)&attributeBindings);
+
+	// Deleting the bound vertex array binds 0
+	CachedState<GLuint>& vertexArray = s_stateCache.vertexArray;
+	if (vertexArray.known && vertexArray.value == (GLuint)attributeBindings)
+		vertexArray.value = 0;
 }
 
 void bindAttributes(const AttributeBindingsHandle& attributeBindings)
 {
-	glBindVertexArray((GLuint)attributeBindings);
+	if (updateCachedState(s_stateCache.vertexArray, (GLuint)attributeBindings))
+		glBindVertexArray((GLuint)attributeBindings);
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void bindAttributes(const span<const AttributeBindingInfo>& attributeBindings)
@@ -329,21 +984,25 @@ void bindAttributes(const span<const AttributeBindingInfo>& attributeBindings)
 		const AttributeTypeInfo& attrTypeInfo = s_attributeTypeInfos[(int)info.type];
 		glVertexAttribPointer((GLuint)info.attribute, (GLint)info.count, attrTypeInfo.type, 
 				attrTypeInfo.normalized, (GLsizei)info.stride, (void*)(uintptr_t)info.offset);
+		glVertexAttribDivisor((GLuint)info.attribute, (GLuint)info.divisor);
 	}
 }
 
 void storeAttributeBindings(const AttributeBindingsHandle& handle, const span<const AttributeBindingInfo>& attributeBindings)
 {
-	glBindVertexArray((GLuint)handle);
+	bindAttributes(handle);
 	bindAttributes(attributeBindings);
-	bindAttributes(0);
+	bindAttributes(AttributeBindingsHandle(0));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void bindProgram(not_null<const Program*> program)
 {
-	glUseProgram(program->programHandle);
+	if (updateCachedState(s_stateCache.program, program->programHandle))
+		glUseProgram(program->programHandle);
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void setUniform(UniformHandle handle, const mat4& value)
@@ -356,31 +1015,332 @@ void setUniform(UniformHandle handle, const TextureChannel& value)
     glUniform1i(handle, value);
 }
 
+void setUniform(UniformHandle handle, float value)
+{
+    glUniform1f(handle, value);
+}
+
+void setUniform(UniformHandle handle, int value)
+{
+    glUniform1i(handle, value);
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-TextureHandle create2dTexture(uint width, uint height, not_null<const void*> data)
+struct TextureFormatInfo
+{
+	GLint internalFormat;
+	GLenum format;
+	uint pixelSize;
+};
+
+static const TextureFormatInfo s_textureFormatInfos[] = 
+	{
+		{ GL_RGBA8, GL_RGBA, 4 },	// TextureFormat::RGBA8
+		{ GL_RG8, GL_RG, 2 },		// TextureFormat::RG8
+		{ GL_R8, GL_RED, 1 },		// TextureFormat::R8
+	};
+
+struct TextureUpload
+{
+	TextureCreationParams params;
+	GLuint pixelBuffer;
+	void* data;
+	GLuint texture;
+	// Set once the texture has been specified from the pixel buffer
+	GLsync fence;
+};
+
+uint getTextureDataSize(const TextureCreationParams& params)
+{
+	return params.width * params.height * s_textureFormatInfos[(int)params.format].pixelSize;
+}
+
+// Creates texture bound to active channel, and specifies it from data, or from the bound pixel buffer if data is null
+static GLuint createTexture(const TextureCreationParams& params, const void* data)
 {
 	GLuint texId;	
 	glGenTextures(1, &texId);
 	glBindTexture(GL_TEXTURE_2D, texId);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	// Bound to whichever channel is active
+	if (s_stateCache.activeChannel.known)
+	{
+		s_stateCache.textures[s_stateCache.activeChannel.value].value = texId;
+		s_stateCache.textures[s_stateCache.activeChannel.value].known = true;
+	}
+	else
+	{
+		for (auto& texture : s_stateCache.textures)
+			texture.known = false;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)width, (GLsizei)height, 0,
-			GL_RGBA, GL_UNSIGNED_BYTE, data);
 
-	return TextureHandle(texId);
+	// Rows of one and two channel formats need not be four byte aligned
+	const TextureFormatInfo& formatInfo = s_textureFormatInfos[(int)params.format];
+	if (formatInfo.pixelSize != 4)
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, formatInfo.internalFormat, (GLsizei)params.width, (GLsizei)params.height, 0,
+			formatInfo.format, GL_UNSIGNED_BYTE, data);
+	if (formatInfo.pixelSize != 4)
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	if (params.mipmaps)
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+	return texId;
+}
+
+TextureHandle create2dTexture(uint width, uint height, not_null<const void*> data)
+{
+	const TextureCreationParams params = { width, height, TextureFormat::RGBA8, false };
+	return create2dTexture(params, data);
+}
+
+TextureHandle create2dTexture(const TextureCreationParams& params, not_null<const void*> data)
+{
+	return TextureHandle(createTexture(params, data));
+}
+
+owned_ptr<TextureUpload> beginTextureUpload(const TextureCreationParams& params)
+{
+	const uint size = getTextureDataSize(params);
+
+	TextureUpload* upload = new TextureUpload { params, 0, nullptr, 0, nullptr };
+	glGenBuffers(1, &upload->pixelBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pixelBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	upload->data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	// Client memory texture uploads would read from the pixel buffer while bound
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	FATAL_ASSERT_DESC(upload->data, "Could not map texture upload pixel buffer");
+
+	return owned_ptr<TextureUpload>(upload);
+}
+
+not_null<void*> getTextureUploadData(not_null<TextureUpload*> upload)
+{
+	FATAL_ASSERT_DESC(upload->data, "Texture upload data can only be written before endTextureUpload");
+	return upload->data;
+}
+
+TextureHandle endTextureUpload(not_null<TextureUpload*> upload)
+{
+	PROFILER_SCOPE("EndTextureUpload", &kProfilerCategoryGraphics);
+	FATAL_ASSERT_DESC(upload->data, "Texture upload already ended");
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pixelBuffer);
+	// Contents are undefined if the mapping was lost, texture is still created so callers need not care
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+		LOG("Texture upload pixel buffer contents were lost");
+	upload->data = nullptr;
+
+	upload->texture = createTexture(upload->params, nullptr);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	PROFILER_COUNTER_ADD("TextureUploadBytes", getTextureDataSize(upload->params));
+
+	return TextureHandle(upload->texture);
+}
+
+bool isTextureUploadComplete(not_null<TextureUpload*> upload)
+{
+	if (!upload->fence)
+		return false;
+
+	const GLenum result = glClientWaitSync(upload->fence, 0, 0);
+	return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+void destroyTextureUpload(owned_ptr<TextureUpload> upload)
+{
+	TextureUpload* uploadPtr = upload.release();
+	if (uploadPtr->data)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadPtr->pixelBuffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	if (uploadPtr->fence)
+		glDeleteSync(uploadPtr->fence);
+	glDeleteBuffers(1, &uploadPtr->pixelBuffer);
+
+	delete(uploadPtr);
 }
 
 void destroyTexture(const TextureHandle& texture)
 {
 	glDeleteTextures(1, (const GLuint*)&texture);
+
+	// Deleted textures are unbound from every channel
+	for (auto& cachedTexture : s_stateCache.textures)
+	{
+		if (cachedTexture.known && cachedTexture.value == (GLuint)texture)
+			cachedTexture.value = 0;
+	}
 }
 
 void bind2dTexture(const TextureChannel& channel, const TextureHandle& texture)
 {
-    glActiveTexture(channel);	
+	FATAL_ASSERT_DESC(channel < StateCache::kTextureChannelCount, "Texture channel out of range");
+
+	if (!updateCachedState(s_stateCache.textures[channel], (GLuint)texture))
+	{
+		if (s_stateCache.validate)
+			validateStateCache();
+		return;
+	}
+
+	if (updateCachedState(s_stateCache.activeChannel, (GLuint)channel))
+		glActiveTexture(GL_TEXTURE0 + channel);
 	glBindTexture(GL_TEXTURE_2D, (GLuint)texture);
+	if (s_stateCache.validate)
+		validateStateCache();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static GLuint allocateGpuQuery()
+{
+	auto& freeQueries = s_gpuProfiler.freeQueries;
+	if (freeQueries.empty())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		return query;
+	}
+
+	const GLuint query = freeQueries.back();
+	freeQueries.pop_back();
+	return query;
+}
+
+static void recycleGpuProfilerFrame(GpuProfilerFrame& frame)
+{
+	for (const GpuScope& scope : frame.scopes)
+	{
+		s_gpuProfiler.freeQueries.push_back(scope.beginQuery);
+		s_gpuProfiler.freeQueries.push_back(scope.endQuery);
+	}
+	frame.scopes.clear();
+}
+
+// Queries belong to the context, so anything pending is dropped along with it
+static void resetGpuProfiler()
+{
+	for (GpuProfilerFrame& frame : s_gpuProfiler.frames)
+		frame.scopes.clear();
+	s_gpuProfiler.freeQueries.clear();
+	s_gpuProfiler.scopeStack.clear();
+	s_gpuProfiler.resolvedFrameNumber = s_gpuProfiler.frameNumber;
+}
+
+void beginGpuScope(not_null<const Profiler::SampleInfo*> info)
+{
+	#if defined(SUPPORTS_TIMER_QUERY)
+	if (!s_capabilities.timerQuery)
+		return;
+
+	GpuProfilerFrame& frame = s_gpuProfiler.frames[s_gpuProfiler.frameNumber % kGpuProfilerFrameCount];
+	if (frame.scopes.empty())
+	{
+		frame.cpuReferenceTime = Profiler::getTime();
+		glGetInteger64v(GL_TIMESTAMP, &frame.gpuReferenceTime);
+		frame.profilerFrameNumber = Profiler::getProfiler()->getFrameCount();
+	}
+
+	auto& scopeStack = s_gpuProfiler.scopeStack;
+	if (scopeStack.size() > 0)
+		frame.scopes[scopeStack.back()].childCount++;
+	scopeStack.push_back((uint)frame.scopes.size());
+
+	GpuScope scope{ info, allocateGpuQuery(), allocateGpuQuery(), 0, 0 };
+	glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+	frame.scopes.push_back(scope);
+	#endif
+}
+
+void endGpuScope()
+{
+	#if defined(SUPPORTS_TIMER_QUERY)
+	if (!s_capabilities.timerQuery)
+		return;
+
+	GpuProfilerFrame& frame = s_gpuProfiler.frames[s_gpuProfiler.frameNumber % kGpuProfilerFrameCount];
+	auto& scopeStack = s_gpuProfiler.scopeStack;
+	ASSERT_DESC(scopeStack.size() > 0, "Unmatched GPU scope end");
+
+	GpuScope& scope = frame.scopes[scopeStack.back()];
+	scope.descendantCount = (int)frame.scopes.size() - 1 - (int)scopeStack.back();
+	scopeStack.pop_back();
+
+	glQueryCounter(scope.endQuery, GL_TIMESTAMP);
+	frame.lastQuery = scope.endQuery;
+	#endif
+}
+
+// Reads back frames oldest first, stops at the first one still in flight
+static void resolveGpuProfilerFrames()
+{
+	#if defined(SUPPORTS_TIMER_QUERY)
+	auto& gpuProfiler = s_gpuProfiler;
+	for (; gpuProfiler.resolvedFrameNumber < gpuProfiler.frameNumber; ++gpuProfiler.resolvedFrameNumber)
+	{
+		GpuProfilerFrame& frame = gpuProfiler.frames[gpuProfiler.resolvedFrameNumber % kGpuProfilerFrameCount];
+		if (frame.scopes.empty())
+			continue;
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		auto& samples = gpuProfiler.samples;
+		samples.clear();
+		for (const GpuScope& scope : frame.scopes)
+		{
+			GLuint64 beginTime = 0;
+			GLuint64 endTime = 0;
+			glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &beginTime);
+			glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &endTime);
+
+			Profiler::Sample sample(scope.info);
+			sample.startTime = frame.cpuReferenceTime + fromNanoseconds((GLint64)beginTime - frame.gpuReferenceTime);
+			sample.duration = fromNanoseconds((int64)(endTime - beginTime));
+			sample.childCount = scope.childCount;
+			sample.descendantCount = scope.descendantCount;
+			samples.push_back(sample);
+		}
+
+		auto profiler = Profiler::getProfiler();
+		if (!gpuProfiler.laneRegistered)
+		{
+			gpuProfiler.lane = profiler->registerLane("GPU");
+			gpuProfiler.laneRegistered = true;
+		}
+		profiler->submitLaneSamples(gpuProfiler.lane, frame.profilerFrameNumber, samples);
+
+		recycleGpuProfilerFrame(frame);
+	}
+	#endif
+}
+
+static void advanceGpuProfilerFrame()
+{
+	auto& gpuProfiler = s_gpuProfiler;
+	ASSERT_DESC(gpuProfiler.scopeStack.size() == 0, "GPU scopes can not span swaps");
+	++gpuProfiler.frameNumber;
+
+	// Never wait on the GPU, drop the oldest frame if it is still in flight when its slot is needed
+	if (gpuProfiler.frameNumber - gpuProfiler.resolvedFrameNumber >= kGpuProfilerFrameCount)
+	{
+		recycleGpuProfilerFrame(gpuProfiler.frames[gpuProfiler.resolvedFrameNumber % kGpuProfilerFrameCount]);
+		++gpuProfiler.resolvedFrameNumber;
+		PROFILER_COUNTER_ADD("GPUFramesDropped", 1);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -389,18 +1349,42 @@ void swapWindow(not_null<Window*> window)
 {
 	PROFILER_SCOPE("Swap", &kProfilerCategoryGraphics);	
 	SDL_GL_SwapWindow(window->sdlWindow);
+
+	if (s_capabilities.timerQuery)
+	{
+		resolveGpuProfilerFrames();
+		advanceGpuProfilerFrame();
+	}
+
+	PROFILER_COUNTER_ADD("GLStateCallsIssued", s_stateCache.issuedCallCount);
+	PROFILER_COUNTER_ADD("GLStateCallsSkipped", s_stateCache.skippedCallCount);
+	s_stateCache.issuedCallCount = 0;
+	s_stateCache.skippedCallCount = 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void drawIndexed(const PrimitiveType& primitiveType, uint primitiveCount, const IndexType& indexType, uint indexOffset)
+static const GLenum s_primitiveTypes[] = { GL_TRIANGLES, GL_TRIANGLE_STRIP };
+
+static GLsizei primitiveVertexCount(const PrimitiveType& primitiveType, uint primitiveCount)
+{
+	if (primitiveType == PrimitiveType::TriangleStrip)
+		return primitiveCount + 2;
+	return primitiveCount * 3;
+}
+
+void drawIndexed(const PrimitiveType& primitiveType, uint primitiveCount, const IndexType& indexType, uint indexOffset, uint baseVertex)
 {
-	static const GLenum ptypes[] = { GL_TRIANGLES };
-	static const GLenum pcount[] = { 3 };
 	static const GLenum itypes[] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
 
-	const GLsizei count = primitiveCount * pcount[(int)primitiveType];
-	glDrawElements(ptypes[(int)primitiveType], count, itypes[(int)indexType], (const GLvoid*)(uintptr_t)indexOffset);
+	const GLsizei count = primitiveVertexCount(primitiveType, primitiveCount);
+	glDrawElementsBaseVertex(s_primitiveTypes[(int)primitiveType], count, itypes[(int)indexType], 
+			(const GLvoid*)(uintptr_t)indexOffset, (GLint)baseVertex);
+}
+
+void drawInstanced(const PrimitiveType& primitiveType, uint vertexCount, uint instanceCount)
+{
+	glDrawArraysInstanced(s_primitiveTypes[(int)primitiveType], 0, (GLsizei)vertexCount, (GLsizei)instanceCount);
 }
 
 void setViewport(const Rect2i& screenRect)
@@ -410,45 +1394,77 @@ void setViewport(const Rect2i& screenRect)
 
 void setBlendMode(const BlendMode& blendMode)
 {
-	switch (blendMode)
+	if (updateCachedState(s_stateCache.blendMode, blendMode))
 	{
-		case BlendMode::AlphaBlend:
-			glEnable(GL_BLEND);
-			glBlendEquation(GL_FUNC_ADD);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-			break;
-		case BlendMode::Disabled:
-			glDisable(GL_BLEND);
+		switch (blendMode)
+		{
+			case BlendMode::AlphaBlend:
+				glEnable(GL_BLEND);
+				glBlendEquation(GL_FUNC_ADD);
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				break;
+			case BlendMode::Disabled:
+				glDisable(GL_BLEND);
+		}
 	}
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void setDepthTestMode(const DepthTestMode& depthTestMode)
 {
-	if (depthTestMode == DepthTestMode::Disabled)
-		glDisable(GL_DEPTH_TEST);
-	else
-		glEnable(GL_DEPTH_TEST);
+	if (updateCachedState(s_stateCache.depthTestMode, depthTestMode))
+	{
+		if (depthTestMode == DepthTestMode::Disabled)
+			glDisable(GL_DEPTH_TEST);
+		else
+			glEnable(GL_DEPTH_TEST);
+	}
+	if (s_stateCache.validate)
+		validateStateCache();
+}
+
+void setDepthWriteMode(const DepthWriteMode& depthWriteMode)
+{
+	if (updateCachedState(s_stateCache.depthWriteMode, depthWriteMode))
+		glDepthMask(depthWriteMode == DepthWriteMode::Enabled ? GL_TRUE : GL_FALSE);
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void setCullMode(const CullMode& cullMode)
 {
-	if (cullMode == CullMode::Disabled)
-		glDisable(GL_CULL_FACE);
-	else
-		glEnable(GL_CULL_FACE);
+	if (updateCachedState(s_stateCache.cullMode, cullMode))
+	{
+		if (cullMode == CullMode::Disabled)
+			glDisable(GL_CULL_FACE);
+		else
+			glEnable(GL_CULL_FACE);
+	}
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void setClipMode(const ClipMode& clipMode)
 {
-	if (clipMode == ClipMode::Disabled)
-		glDisable(GL_SCISSOR_TEST);
-	else
-		glEnable(GL_SCISSOR_TEST);
+	if (updateCachedState(s_stateCache.clipMode, clipMode))
+	{
+		if (clipMode == ClipMode::Disabled)
+			glDisable(GL_SCISSOR_TEST);
+		else
+			glEnable(GL_SCISSOR_TEST);
+	}
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 	
 void setClipArea(const Rect2i& screenRect)
 {
-	glScissor(screenRect.p1.x, screenRect.p1.y, screenRect.width(), screenRect.height());
+	const vec4i clipArea = vec4i(screenRect.p1.x, screenRect.p1.y, screenRect.width(), screenRect.height());
+	if (updateCachedState(s_stateCache.clipArea, clipArea))
+		glScissor(screenRect.p1.x, screenRect.p1.y, screenRect.width(), screenRect.height());
+	if (s_stateCache.validate)
+		validateStateCache();
 }
 
 void setClearColor(const Color32& color)
@@ -458,7 +1474,395 @@ void setClearColor(const Color32& color)
 
 void clearFrameBuffer()
 {
-	glClear(GL_COLOR_BUFFER_BIT);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void clearDepthBuffer()
+{
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class CommandType : uint8
+{
+	BindProgram = 0,
+	SetUniformMat4,
+	SetUniformInt,
+	BindAttributes,
+	BindIndexBuffer,
+	Bind2dTexture,
+	SetBlendMode,
+	SetDepthTestMode,
+	SetClipMode,
+	SetClipArea,
+	DrawIndexed,
+	DrawInstanced,
+	UploadStreamBufferData,
+	StoreAttributeBindings
+};
+
+// Every command starts with a header, size includes header and padding
+struct CommandHeader
+{
+	CommandType type;
+	uint32 size;
+};
+
+// Keeps every command aligned for its largest member
+static const uint kCommandAlignment = 8;
+
+namespace commands
+{
+	struct BindProgram { CommandHeader header; const Program* program; };
+	struct SetUniformMat4 { CommandHeader header; UniformHandle handle; mat4 value; };
+	struct SetUniformInt { CommandHeader header; UniformHandle handle; int value; };
+	struct BindHandle { CommandHeader header; uint handle; };
+	struct Bind2dTexture { CommandHeader header; TextureChannel channel; TextureHandle texture; };
+	struct SetMode { CommandHeader header; uint mode; };
+	struct SetClipArea { CommandHeader header; Rect2i screenRect; };
+	struct DrawIndexed { CommandHeader header; PrimitiveType primitiveType; uint primitiveCount; IndexType indexType; uint indexOffset; uint baseVertex; };
+	struct DrawInstanced { CommandHeader header; PrimitiveType primitiveType; uint vertexCount; uint instanceCount; };
+	// Followed by size bytes of data
+	struct UploadStreamBufferData { CommandHeader header; StreamBuffer* streamBuffer; uint size; uint alignment; };
+	// Followed by bindingCount bindings
+	struct StoreAttributeBindings { CommandHeader header; uint handle; uint bindingCount; };
+}
+
+struct CommandBuffer
+{
+	vector<uint8> data;
+	uint commandCount;
+};
+
+owned_ptr<CommandBuffer> createCommandBuffer()
+{
+	CommandBuffer* commandBuffer = new CommandBuffer { {}, 0 };
+	return owned_ptr<CommandBuffer>(commandBuffer);
+}
+
+void destroyCommandBuffer(owned_ptr<CommandBuffer> commandBuffer)
+{
+	delete(commandBuffer.release());
+}
+
+void resetCommandBuffer(not_null<CommandBuffer*> commandBuffer)
+{
+	commandBuffer->data.clear();
+	commandBuffer->commandCount = 0;
+}
+
+uint getCommandCount(not_null<const CommandBuffer*> commandBuffer)
+{
+	return commandBuffer->commandCount;
+}
+
+// Appends a command with header filled in, pointer is valid until next command is recorded
+//	Payload is reserved right after the command, see getCommandPayload
+template<typename T>
+static T* appendCommand(CommandBuffer& commandBuffer, CommandType type, uint payloadSize = 0)
+{
+	static_assert(alignof(T) <= kCommandAlignment, "Command is aligned beyond command alignment");
+
+	const uint size = alignUp(sizeof(T) + payloadSize, kCommandAlignment);
+	const size_t offset = commandBuffer.data.size();
+	commandBuffer.data.resize(offset + size);
+	++commandBuffer.commandCount;
+
+	T* const command = (T*)(commandBuffer.data.data() + offset);
+	command->header.type = type;
+	command->header.size = size;
+	return command;
+}
+
+template<typename T>
+static uint8* getCommandPayload(T* command)
+{
+	return (uint8*)(command + 1);
+}
+
+template<typename T>
+static const uint8* getCommandPayload(const T* command)
+{
+	return (const uint8*)(command + 1);
+}
+
+void recordBindProgram(not_null<CommandBuffer*> commandBuffer, not_null<const Program*> program)
+{
+	appendCommand<commands::BindProgram>(*commandBuffer, CommandType::BindProgram)->program = program;
+}
+
+void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, const mat4& value)
+{
+	auto command = appendCommand<commands::SetUniformMat4>(*commandBuffer, CommandType::SetUniformMat4);
+	command->handle = handle;
+	command->value = value;
+}
+
+void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, const TextureChannel& value)
+{
+	recordSetUniform(commandBuffer, handle, (int)value);
+}
+
+void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, int value)
+{
+	auto command = appendCommand<commands::SetUniformInt>(*commandBuffer, CommandType::SetUniformInt);
+	command->handle = handle;
+	command->value = value;
+}
+
+void recordBindAttributes(not_null<CommandBuffer*> commandBuffer, const AttributeBindingsHandle& attributeBindings)
+{
+	appendCommand<commands::BindHandle>(*commandBuffer, CommandType::BindAttributes)->handle = attributeBindings;
+}
+
+void recordBindIndexBuffer(not_null<CommandBuffer*> commandBuffer, const BufferHandle& buffer)
+{
+	appendCommand<commands::BindHandle>(*commandBuffer, CommandType::BindIndexBuffer)->handle = buffer;
+}
+
+void recordBind2dTexture(not_null<CommandBuffer*> commandBuffer, const TextureChannel& channel, const TextureHandle& texture)
+{
+	auto command = appendCommand<commands::Bind2dTexture>(*commandBuffer, CommandType::Bind2dTexture);
+	command->channel = channel;
+	command->texture = texture;
+}
+
+void recordSetBlendMode(not_null<CommandBuffer*> commandBuffer, const BlendMode& blendMode)
+{
+	appendCommand<commands::SetMode>(*commandBuffer, CommandType::SetBlendMode)->mode = (uint)blendMode;
+}
+
+void recordSetDepthTestMode(not_null<CommandBuffer*> commandBuffer, const DepthTestMode& depthTestMode)
+{
+	appendCommand<commands::SetMode>(*commandBuffer, CommandType::SetDepthTestMode)->mode = (uint)depthTestMode;
+}
+
+void recordSetClipMode(not_null<CommandBuffer*> commandBuffer, const ClipMode& clipMode)
+{
+	appendCommand<commands::SetMode>(*commandBuffer, CommandType::SetClipMode)->mode = (uint)clipMode;
+}
+
+void recordSetClipArea(not_null<CommandBuffer*> commandBuffer, const Rect2i& screenRect)
+{
+	appendCommand<commands::SetClipArea>(*commandBuffer, CommandType::SetClipArea)->screenRect = screenRect;
+}
+
+void recordDrawIndexed(not_null<CommandBuffer*> commandBuffer, const PrimitiveType& primitiveType, uint primitiveCount, 
+		const IndexType& indexType, uint indexOffset, uint baseVertex)
+{
+	auto command = appendCommand<commands::DrawIndexed>(*commandBuffer, CommandType::DrawIndexed);
+	command->primitiveType = primitiveType;
+	command->primitiveCount = primitiveCount;
+	command->indexType = indexType;
+	command->indexOffset = indexOffset;
+	command->baseVertex = baseVertex;
+}
+
+void recordDrawInstanced(not_null<CommandBuffer*> commandBuffer, const PrimitiveType& primitiveType, uint vertexCount, uint instanceCount)
+{
+	auto command = appendCommand<commands::DrawInstanced>(*commandBuffer, CommandType::DrawInstanced);
+	command->primitiveType = primitiveType;
+	command->vertexCount = vertexCount;
+	command->instanceCount = instanceCount;
+}
+
+void recordUploadStreamBufferData(not_null<CommandBuffer*> commandBuffer, not_null<StreamBuffer*> streamBuffer, 
+		not_null<const void*> data, uint size, uint alignment)
+{
+	auto command = appendCommand<commands::UploadStreamBufferData>(*commandBuffer, CommandType::UploadStreamBufferData, size);
+	command->streamBuffer = streamBuffer;
+	command->size = size;
+	command->alignment = alignment;
+	memcpy(getCommandPayload(command), data, size);
+}
+
+void recordStoreAttributeBindings(not_null<CommandBuffer*> commandBuffer, const AttributeBindingsHandle& handle, 
+		const span<const AttributeBindingInfo>& attributeBindings)
+{
+	const uint bindingCount = attributeBindings.size();
+	auto command = appendCommand<commands::StoreAttributeBindings>(*commandBuffer, CommandType::StoreAttributeBindings, 
+			bindingCount * sizeof(AttributeBindingInfo));
+	command->handle = handle;
+	command->bindingCount = bindingCount;
+	memcpy(getCommandPayload(command), attributeBindings.data(), bindingCount * sizeof(AttributeBindingInfo));
+}
+
+void executeCommandBuffer(not_null<const CommandBuffer*> commandBuffer)
+{
+	PROFILER_SCOPE("ExecuteCommandBuffer", &kProfilerCategoryGraphics);
+
+	// Where the last upload landed, bindings without a buffer source it
+	StreamBuffer* uploadStreamBuffer = nullptr;
+	uint uploadOffset = 0;
+	// Fenced once all draws are issued
+	vector<StreamBuffer*> uploadedStreamBuffers;
+	vector<AttributeBindingInfo> attributeBindings;
+
+	const uint8* cursor = commandBuffer->data.data();
+	const uint8* const end = cursor + commandBuffer->data.size();
+	while (cursor < end)
+	{
+		const CommandHeader& header = *(const CommandHeader*)cursor;
+		switch (header.type)
+		{
+			case CommandType::BindProgram:
+				bindProgram(((const commands::BindProgram*)cursor)->program);
+				break;
+			case CommandType::SetUniformMat4:
+			{
+				auto command = (const commands::SetUniformMat4*)cursor;
+				setUniform(command->handle, command->value);
+				break;
+			}
+			case CommandType::SetUniformInt:
+			{
+				auto command = (const commands::SetUniformInt*)cursor;
+				setUniform(command->handle, command->value);
+				break;
+			}
+			case CommandType::BindAttributes:
+				bindAttributes(AttributeBindingsHandle(((const commands::BindHandle*)cursor)->handle));
+				break;
+			case CommandType::BindIndexBuffer:
+				bindIndexBuffer(BufferHandle(((const commands::BindHandle*)cursor)->handle));
+				break;
+			case CommandType::Bind2dTexture:
+			{
+				auto command = (const commands::Bind2dTexture*)cursor;
+				bind2dTexture(command->channel, command->texture);
+				break;
+			}
+			case CommandType::SetBlendMode:
+				setBlendMode((BlendMode)((const commands::SetMode*)cursor)->mode);
+				break;
+			case CommandType::SetDepthTestMode:
+				setDepthTestMode((DepthTestMode)((const commands::SetMode*)cursor)->mode);
+				break;
+			case CommandType::SetClipMode:
+				setClipMode((ClipMode)((const commands::SetMode*)cursor)->mode);
+				break;
+			case CommandType::SetClipArea:
+				setClipArea(((const commands::SetClipArea*)cursor)->screenRect);
+				break;
+			case CommandType::DrawIndexed:
+			{
+				auto command = (const commands::DrawIndexed*)cursor;
+				drawIndexed(command->primitiveType, command->primitiveCount, command->indexType, command->indexOffset, command->baseVertex);
+				break;
+			}
+			case CommandType::DrawInstanced:
+			{
+				auto command = (const commands::DrawInstanced*)cursor;
+				drawInstanced(command->primitiveType, command->vertexCount, command->instanceCount);
+				break;
+			}
+			case CommandType::UploadStreamBufferData:
+			{
+				auto command = (const commands::UploadStreamBufferData*)cursor;
+				void* const data = reserveStreamBufferData(command->streamBuffer, command->size, command->alignment);
+				memcpy(data, getCommandPayload(command), command->size);
+				uploadOffset = commitStreamBufferData(command->streamBuffer, command->size);
+				uploadStreamBuffer = command->streamBuffer;
+				if (std::find(uploadedStreamBuffers.begin(), uploadedStreamBuffers.end(), uploadStreamBuffer) == uploadedStreamBuffers.end())
+					uploadedStreamBuffers.push_back(uploadStreamBuffer);
+				break;
+			}
+			case CommandType::StoreAttributeBindings:
+			{
+				auto command = (const commands::StoreAttributeBindings*)cursor;
+				const AttributeBindingInfo* const recordedBindings = (const AttributeBindingInfo*)getCommandPayload(command);
+				attributeBindings.assign(recordedBindings, recordedBindings + command->bindingCount);
+				for (AttributeBindingInfo& binding : attributeBindings)
+				{
+					if (binding.buffer != 0)
+						continue;
+					ASSERT_DESC(uploadStreamBuffer != nullptr, "Attribute binding sources an upload, but none was recorded before it");
+					binding.buffer = getStreamBufferHandle(uploadStreamBuffer);
+					binding.offset += uploadOffset;
+				}
+				storeAttributeBindings(AttributeBindingsHandle(command->handle), attributeBindings);
+				break;
+			}
+		}
+		cursor += header.size;
+	}
+
+	for (StreamBuffer* streamBuffer : uploadedStreamBuffers)
+		fenceStreamBufferData(streamBuffer);
+
+	PROFILER_COUNTER_ADD("GLCommandsExecuted", commandBuffer->commandCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void setStateCacheValidation(bool enabled)
+{
+	#ifndef RELEASE
+		s_stateCache.validate = enabled;
+	#else
+		(void)enabled;
+	#endif
+}
+
+static void validateStateCache()
+{
+	const StateCache& cache = s_stateCache;
+
+	auto validateEnabled = [](bool known, bool enabled, GLenum cap, const char* desc)
+	{
+		if (known)
+			FATAL_ASSERT_DESC((glIsEnabled(cap) == GL_TRUE) == enabled, desc);
+	};
+	validateEnabled(cache.blendMode.known, cache.blendMode.value != BlendMode::Disabled, GL_BLEND, 
+			"Cached blend mode does not match GL");
+	validateEnabled(cache.depthTestMode.known, cache.depthTestMode.value != DepthTestMode::Disabled, GL_DEPTH_TEST, 
+			"Cached depth test mode does not match GL");
+	validateEnabled(cache.cullMode.known, cache.cullMode.value != CullMode::Disabled, GL_CULL_FACE, 
+			"Cached cull mode does not match GL");
+	validateEnabled(cache.clipMode.known, cache.clipMode.value != ClipMode::Disabled, GL_SCISSOR_TEST, 
+			"Cached clip mode does not match GL");
+
+	if (cache.depthWriteMode.known)
+	{
+		GLboolean depthMask;
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+		FATAL_ASSERT_DESC((depthMask == GL_TRUE) == (cache.depthWriteMode.value == DepthWriteMode::Enabled), 
+				"Cached depth write mode does not match GL");
+	}
+
+	if (cache.clipArea.known)
+	{
+		vec4i box;
+		glGetIntegerv(GL_SCISSOR_BOX, &box[0]);
+		FATAL_ASSERT_DESC(box == cache.clipArea.value, "Cached clip area does not match GL");
+	}
+
+	auto validateBinding = [](const CachedState<GLuint>& state, GLenum binding, const char* desc)
+	{
+		if (!state.known)
+			return;
+		GLint value;
+		glGetIntegerv(binding, &value);
+		FATAL_ASSERT_DESC((GLuint)value == state.value, desc);
+	};
+	validateBinding(cache.program, GL_CURRENT_PROGRAM, "Cached program does not match GL");
+	validateBinding(cache.vertexArray, GL_VERTEX_ARRAY_BINDING, "Cached attribute bindings do not match GL");
+
+	GLint activeTexture;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	if (cache.activeChannel.known)
+		FATAL_ASSERT_DESC((GLuint)activeTexture == GL_TEXTURE0 + cache.activeChannel.value, "Cached texture channel does not match GL");
+
+	// Switches channels to read their bindings, and back again
+	for (uint channel = 0; channel < StateCache::kTextureChannelCount; ++channel)
+	{
+		if (!cache.textures[channel].known)
+			continue;
+		glActiveTexture(GL_TEXTURE0 + channel);
+		validateBinding(cache.textures[channel], GL_TEXTURE_BINDING_2D, "Cached texture binding does not match GL");
+	}
+	glActiveTexture((GLenum)activeTexture);
 }
 
 } // namespace graphics
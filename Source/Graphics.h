@@ -5,11 +5,19 @@
 namespace jcpe
 {
 
+namespace Profiler
+{
+	struct SampleInfo;
+}
+
 namespace Graphics
 {
 	struct Window;
 	struct Context; // TODO: Make this into an interface for rendering primitives? (RenderContext)
 	struct Program;
+	struct StreamBuffer;
+	struct CommandBuffer;
+	struct TextureUpload;
 
 	using UniformHandle = TypeWrapper<uint>;
 	using AttributeHandle = TypeWrapper<uint>;
@@ -25,6 +33,12 @@ namespace Graphics
 		AlphaBlend
 	};
 
+	enum class DepthWriteMode
+	{
+		Disabled,
+		Enabled
+	};
+
 	enum class CullMode
 	{
 		Disabled,
@@ -46,12 +60,29 @@ namespace Graphics
 	enum class AttributeType
 	{
 		Float = 0,
-		NormalizedUInt8
+		NormalizedUInt8,
+		// Converted to float as is, not normalized
+		Int16,
+		NormalizedUInt16
+	};
+
+	enum class TextureFormat
+	{
+		RGBA8 = 0,
+		RG8,
+		R8
 	};
 
 	enum class PrimitiveType
 	{
-		Triangles = 0
+		Triangles = 0,
+		TriangleStrip
+	};
+
+	enum class BufferTarget
+	{
+		Vertex = 0,
+		Index
 	};
 
 	enum class IndexType
@@ -69,6 +100,8 @@ namespace Graphics
 		uint count;
 		uint stride;
 		uint offset;
+		// Advance attribute once per this many instances, 0 for per vertex
+		uint divisor;
 	};
 
 	/*
@@ -92,6 +125,9 @@ namespace Graphics
 
 	owned_ptr<Context> createContext(not_null<Window*> window);
 	void destroyContext(owned_ptr<Context> context);
+	// Context is current on the creating thread, release it there before making it current on another
+	void makeContextCurrent(not_null<Window*> window, not_null<Context*> context);
+	void releaseContextCurrent(not_null<Window*> window);
 
 	/*
 		Shader program creation/destruction
@@ -122,6 +158,32 @@ namespace Graphics
 	void unmapVertexBufferData();
 	void unmapIndexBufferData();
 
+	void uploadStaticVertexBufferData(const BufferHandle& buffer, not_null<const void*> data, const uint size);
+	void bindIndexBuffer(const BufferHandle& buffer);
+
+	/*
+		Streaming buffers
+			Ring buffer mapped once (persistently where supported), handing out sub ranges
+			Ranges are fenced when drawn from, and only reused once the GPU is done with them
+	*/
+
+	owned_ptr<StreamBuffer> createStreamBuffer(const BufferTarget& target, uint capacity);
+	void destroyStreamBuffer(owned_ptr<StreamBuffer> streamBuffer);
+
+	// Storage is replaced if the buffer has to grow, attribute bindings need to be updated then
+	//	The new storage may get the same handle, so compare generation as well
+	BufferHandle getStreamBufferHandle(not_null<const StreamBuffer*> streamBuffer);
+	uint getStreamBufferGeneration(not_null<const StreamBuffer*> streamBuffer);
+
+	// Maps space for up to size bytes, offset is a multiple of alignment (need not be a power of two)
+	not_null<void*> reserveStreamBufferData(not_null<StreamBuffer*> streamBuffer, uint size, uint alignment);
+	// Uploads the first usedSize bytes of the reservation and returns their offset in the buffer
+	uint commitStreamBufferData(not_null<StreamBuffer*> streamBuffer, uint usedSize);
+	// Call after issuing the draws using data committed since last fence
+	void fenceStreamBufferData(not_null<StreamBuffer*> streamBuffer);
+	// Call after issuing draws that reuse data committed in an earlier frame, keeps it from being overwritten while in use
+	void fenceStreamBufferRange(not_null<StreamBuffer*> streamBuffer, uint offset, uint size);
+
 	AttributeBindingsHandle createAttributeBindings();
 	void destroyAttributeBindings(const AttributeBindingsHandle& attributeBindings);	
 	void bindAttributes(const AttributeBindingsHandle& attributeBindings);
@@ -133,11 +195,41 @@ namespace Graphics
 
 	void setUniform(UniformHandle handle, const mat4& value);
 	void setUniform(UniformHandle handle, const TextureChannel& value);
+	void setUniform(UniformHandle handle, float value);
+	void setUniform(UniformHandle handle, int value);
+
+	struct TextureCreationParams
+	{
+		uint width;
+		uint height;
+		TextureFormat format;
+		bool mipmaps;
+	};
+
+	// Bytes of tightly packed pixels of the top level
+	uint getTextureDataSize(const TextureCreationParams& params);
 
+	// RGBA8 without mipmaps
 	TextureHandle create2dTexture(uint width, uint height, not_null<const void*> data);
+	TextureHandle create2dTexture(const TextureCreationParams& params, not_null<const void*> data);
 	void destroyTexture(const TextureHandle& texture);
 	void bind2dTexture(const TextureChannel& channel, const TextureHandle& texture);
 
+	/*
+		Texture uploads
+			Pixels are written into a mapped pixel buffer, by any thread, and copied to the texture by the GPU
+			Begin, end and destroy on the context thread only
+	*/
+
+	owned_ptr<TextureUpload> beginTextureUpload(const TextureCreationParams& params);
+	// Valid until endTextureUpload, getTextureDataSize bytes
+	not_null<void*> getTextureUploadData(not_null<TextureUpload*> upload);
+	// Texture can be used right away, but may stall until isTextureUploadComplete
+	TextureHandle endTextureUpload(not_null<TextureUpload*> upload);
+	bool isTextureUploadComplete(not_null<TextureUpload*> upload);
+	// Texture is left alone
+	void destroyTextureUpload(owned_ptr<TextureUpload> upload);
+
 	/*
 		Frame functions
 	*/
@@ -148,18 +240,91 @@ namespace Graphics
 		Rendering primitive functions
 	*/
 
-	void drawIndexed(const PrimitiveType& primitiveType, uint primitiveCount, const IndexType& indexType, uint indexOffset);
+	void drawIndexed(const PrimitiveType& primitiveType, uint primitiveCount, const IndexType& indexType, uint indexOffset, uint baseVertex);
+	void drawInstanced(const PrimitiveType& primitiveType, uint vertexCount, uint instanceCount);
 
 	void setViewport(const Rect2i& screenRect);
 	void setBlendMode(const BlendMode& blendMode);
 	void setDepthTestMode(const DepthTestMode& depthTestMode);
+	// Depth writes also mask depth clears, so leave enabled when done
+	void setDepthWriteMode(const DepthWriteMode& depthWriteMode);
 	void setCullMode(const CullMode& cullMode);
 	void setClipMode(const ClipMode& clipMode);
 	void setClipArea(const Rect2i& screenRect);
 
 	void setClearColor(const Color32& color);
+	// Clears color and depth
 	void clearFrameBuffer();
+	// Clears depth only, masked by depth write and clip modes like any clear
+	void clearDepthBuffer();
+
+	/*
+		Command buffers
+			Linear buffers of recorded calls, replayed in order on the thread owning the context
+			Recording touches no GL state, so any thread can record, but each buffer only one thread at a time
+			Objects referenced by recorded commands have to outlive the replay
+	*/
+
+	owned_ptr<CommandBuffer> createCommandBuffer();
+	void destroyCommandBuffer(owned_ptr<CommandBuffer> commandBuffer);
+	// Drops recorded commands but keeps the allocation
+	void resetCommandBuffer(not_null<CommandBuffer*> commandBuffer);
+	uint getCommandCount(not_null<const CommandBuffer*> commandBuffer);
+
+	// Same as the immediate functions above, only deferred until replayed
+	void recordBindProgram(not_null<CommandBuffer*> commandBuffer, not_null<const Program*> program);
+	void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, const mat4& value);
+	void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, const TextureChannel& value);
+	void recordSetUniform(not_null<CommandBuffer*> commandBuffer, UniformHandle handle, int value);
+	void recordBindAttributes(not_null<CommandBuffer*> commandBuffer, const AttributeBindingsHandle& attributeBindings);
+	void recordBindIndexBuffer(not_null<CommandBuffer*> commandBuffer, const BufferHandle& buffer);
+	void recordBind2dTexture(not_null<CommandBuffer*> commandBuffer, const TextureChannel& channel, const TextureHandle& texture);
+	void recordSetBlendMode(not_null<CommandBuffer*> commandBuffer, const BlendMode& blendMode);
+	void recordSetDepthTestMode(not_null<CommandBuffer*> commandBuffer, const DepthTestMode& depthTestMode);
+	void recordSetClipMode(not_null<CommandBuffer*> commandBuffer, const ClipMode& clipMode);
+	void recordSetClipArea(not_null<CommandBuffer*> commandBuffer, const Rect2i& screenRect);
+	void recordDrawIndexed(not_null<CommandBuffer*> commandBuffer, const PrimitiveType& primitiveType, uint primitiveCount, 
+			const IndexType& indexType, uint indexOffset, uint baseVertex);
+	void recordDrawInstanced(not_null<CommandBuffer*> commandBuffer, const PrimitiveType& primitiveType, uint vertexCount, uint instanceCount);
+
+	// Data is copied into the command buffer, replay commits it to a range reserved in the stream buffer
+	//	Stream buffers uploaded to are fenced once replay is done, after the draws sourcing them
+	void recordUploadStreamBufferData(not_null<CommandBuffer*> commandBuffer, not_null<StreamBuffer*> streamBuffer, 
+			not_null<const void*> data, uint size, uint alignment);
+	// Same as storeAttributeBindings, but bindings without a buffer source the last recorded upload, offset from its start
+	void recordStoreAttributeBindings(not_null<CommandBuffer*> commandBuffer, const AttributeBindingsHandle& handle, 
+			const span<const AttributeBindingInfo>& attributeBindings);
+
+	// Context thread only, buffer is left as is and can be replayed again
+	void executeCommandBuffer(not_null<const CommandBuffer*> commandBuffer);
+
+	/*
+		State cache
+			State set above is shadowed, and calls that would not change it are skipped
+			Issued and skipped calls are reported to the profiler as counters on swap
+	*/
+
+	// Call after changing GL state outside of this module
+	void invalidateStateCache();
+	// Checks the cache against glGet after every state call, no effect in release builds
+	void setStateCacheValidation(bool enabled);
+
+	/*
+		GPU profiling
+			Scopes are timed with timestamp queries and submitted to the profiler as a "GPU" lane
+			Results are read back on swap once available, a few frames late, so reading never stalls
+			No effect if the context has no timer queries
+	*/
+
+	// Context thread only, scopes nest and have to end before swap
+	void beginGpuScope(not_null<const Profiler::SampleInfo*> info);
+	void endGpuScope();
 
 } // namespace graphics
 
 }
+
+#define GPU_PROFILER_SCOPE(name, categoryPtr)													   \
+	static const Profiler::SampleInfo gpuScopeInfo{ name, categoryPtr };						   \
+	Graphics::beginGpuScope(&gpuScopeInfo);														   \
+	SCOPE_EXIT( Graphics::endGpuScope(); )
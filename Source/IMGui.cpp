@@ -1,5 +1,10 @@
 #include "IMGui.h"
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
 #include "Core.h"
 
 #define NK_PRIVATE
@@ -10,12 +15,15 @@
 #define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
 #define NK_INCLUDE_FONT_BAKING
 #define NK_INCLUDE_DEFAULT_FONT
+#define NK_UINT_DRAW_INDEX
 #define NK_IMPLEMENTATION
 #define NK_ASSERT(expr) ASSERT(expr)
 #include "nuklear.h"
 
 #include "ColorDefines.h"
+#include "File.h"
 #include "Graphics.h"
+#include "Jobs.h"
 #include "Profiler.h"
 
 // TODO: Get rid of
@@ -37,9 +45,28 @@ namespace imGui
 		nk_byte color[4];
 	};
 
-	// Limited to 2^16 atm since index is forced uint16
-	static const uint MAX_VERTEX_COUNT = 0xFFFF;
-	static const uint MAX_INDEX_COUNT =  MAX_VERTEX_COUNT * 3;
+	// Native vertex in IMGuiVertexFormat::Compact, most native geometry is untextured and pixel aligned
+	//	so 1/8 unit positions and 16 bit uvs lose nothing visible
+	struct CompactVertex
+	{
+		int16 pos[2];
+		uint16 uv[2];
+		nk_byte color[4];
+	};
+
+	static_assert(sizeof(CompactVertex) == 12, "Compact vertex has to be tightly packed");
+	static const float COMPACT_SUBPIXEL_COUNT = 8.0f;
+	static const float COMPACT_UV_SCALE = 65535.0f;
+	// Positions representable in compact vertices, primitives are clipped to this before quantizing
+	static const float COMPACT_POS_MIN = -32768.0f / COMPACT_SUBPIXEL_COUNT;
+	static const float COMPACT_POS_MAX = 32767.0f / COMPACT_SUBPIXEL_COUNT;
+
+	// Reserved space grows on demand, indices are 32 bit so vertex count is not limited
+	static const uint INITIAL_VERTEX_COUNT = 0x10000;
+	static const uint INITIAL_INDEX_COUNT = INITIAL_VERTEX_COUNT * 3;
+	// Stream buffers fit this many frames of reserved space before having to wait for the GPU
+	static const uint STREAM_FRAME_COUNT = 3;
+	static_assert(sizeof(nk_draw_index) == sizeof(uint32), "Nuklear draw index has to be 32 bit");
 
 	static const char* s_vertexSource = R"(
 		#version 150
@@ -70,6 +97,227 @@ namespace imGui
 		}
 		)";
 
+	// Native triangles get depth from draw order, so opaque geometry can be drawn first and hide what is beneath
+	//	Vertices are allocated in call order, so the vertex index is the order
+	static const char* s_nativeVertexSource = R"(
+		#version 150
+		uniform mat4 mvp;
+		uniform int orderOffset;
+		uniform float depthScale;
+		uniform float posScale;
+		in vec2 pos;
+		in vec2 uv;
+		in vec4 color;
+		out vec2 fragUv;
+		out vec4 fragColor;
+		invariant gl_Position;
+		void main()
+		{
+			fragUv = uv;
+			fragColor = color;
+			gl_Position = mvp * vec4(pos.xy * posScale, 0.0, 1.0);
+			gl_Position.z = 1.0 - float(gl_VertexID + orderOffset + 1) * depthScale;
+		}
+		)";
+
+	// Batched circles are drawn as instanced quads, coverage computed from distance to edge
+	struct CircleInstance
+	{
+		float center[2];
+		float radius;
+		// Draw order for depth, shares order space with native vertices
+		float order;
+		nk_byte color[4];
+	};
+
+	static const uint INITIAL_CIRCLE_COUNT = 0x1000;
+
+	static_assert(sizeof(IMGuiCapture::Vertex) == sizeof(NkVertex), "Capture vertex has to match nuklear vertex");
+	static_assert(sizeof(IMGuiCapture::Circle) == sizeof(CircleInstance), "Capture circle has to match circle instance");
+
+	// Begun by beginFrame, at z-order 0
+	static const char* const DEFAULT_LAYER_NAME = "Default";
+
+	// Stand-in font texture id when capturing, there is no graphics context to create one
+	static const uint CAPTURE_FONT_TEXTURE = 1;
+
+	// Run of nuklear draw commands issued as one draw call
+	struct DrawBatch
+	{
+		Graphics::TextureHandle texture;
+		Rect2i clipRect = Rect2i(0, 0, 0, 0);
+		uint indexOffset = 0;
+		uint elementCount = 0;
+	};
+
+	// Native backend primitives are kept in call order, circle instances interleave with triangles
+	enum class NativeBatchType
+	{
+		Triangles = 0,
+		Circles
+	};
+
+	struct NativeBatch
+	{
+		NativeBatchType type;
+		// Chunk 0 is written straight into the stream buffers, chunk 1 collects overflow of the reservation
+		uint chunk;
+		// Range of indices or circle instances
+		uint first;
+		uint count;
+	};
+
+	// Where a native primitive's geometry goes, indices are relative to first vertex of chunk
+	//	Opaque indices are kept apart from blended ones, in reverse call order where possible
+	struct NativeRange
+	{
+		uint chunk;
+		uint firstVertex;
+		uint firstIndex;
+		bool opaque;
+	};
+
+	struct NativeAllocation
+	{
+		uint8* vertices;
+		IMGuiVertexFormat format;
+		nk_draw_index* indices;
+		uint firstVertex;
+	};
+
+	enum class NativePrimitiveType
+	{
+		Rect = 0,
+		FilledCircle,
+		StrokedCircle,
+		Text
+	};
+
+	// Space is allocated when recorded, so primitives can be tessellated in any order or in parallel
+	struct NativePrimitive
+	{
+		NativePrimitiveType type;
+		NativeRange range;
+		vec4u8 color;
+		// Rect corners, circle center and (radius, line width), or text origin
+		vec2 p1;
+		vec2 p2;
+		// Circle segments or glyphs of text run
+		uint segmentCount = 0;
+		const GlyphRun* glyphRun = nullptr;
+		// Circle crosses compact position range, tessellated as clipped polygons with room for the cut corners
+		bool clipped = false;
+	};
+
+	static const float DEFAULT_FONT_HEIGHT = 13.0f;
+
+	// Baked atlas of default font, written on first launch and loaded instead of baking after that
+	//	Followed by ranges, atlas glyphs and RGBA pixels
+	static const char* const FONT_ATLAS_CACHE_FILE_NAME = "FontAtlas.cache";
+	static const uint32 FONT_ATLAS_CACHE_MAGIC = 0x43415446; // "FTAC"
+	static const uint32 FONT_ATLAS_CACHE_VERSION = 1;
+
+	struct FontAtlasCacheHeader
+	{
+		uint32 magic;
+		uint32 version;
+		// Font data, size and nuklear struct layout the atlas was baked with
+		uint64 sourceHash;
+		// Time it took to bake, to report time saved when loading
+		int64 bakeMicroseconds;
+		int32 width;
+		int32 height;
+		struct nk_recti custom;
+		struct nk_cursor cursors[NK_CURSOR_COUNT];
+		float pixelHeight;
+		float bakedHeight;
+		float ascent;
+		float descent;
+		uint32 fontGlyphOffset;
+		uint32 fontGlyphCount;
+		uint32 fallbackCodepoint;
+		// Includes zero terminator
+		uint32 rangeCount;
+		uint32 atlasGlyphCount;
+	};
+
+	// Measured and laid out text, glyph positions relative to text origin
+	struct GlyphQuad
+	{
+		vec2 p1;
+		vec2 p2;
+		struct nk_vec2 uv1;
+		struct nk_vec2 uv2;
+		// Pen position after this glyph, for clamping to label width
+		float advanceEnd;
+	};
+
+	struct GlyphRun
+	{
+		string text;
+		const nk_user_font* font;
+		float height;
+		float width;
+		vector<GlyphQuad> quads;
+		uint64 lastUsedFrame;
+	};
+
+	// Runs unused for this many frames are evicted, checked every eviction interval
+	static const uint64 GLYPH_RUN_MAX_UNUSED_FRAMES = 120;
+	static const uint64 GLYPH_RUN_EVICTION_INTERVAL = 60;
+
+	// Deferred tessellation is split into jobs of at least this many primitives
+	static const uint NATIVE_MIN_PRIMITIVES_PER_JOB = 256;
+	static const uint NATIVE_JOBS_PER_THREAD = 4;
+
+	// Circle segment count is picked so the distance between chords and true circle stays under this, in pixels
+	static const float NATIVE_CIRCLE_MAX_ERROR = 0.25f;
+	static const uint NATIVE_CIRCLE_MIN_SEGMENT_COUNT = 6;
+	static const uint NATIVE_CIRCLE_MAX_SEGMENT_COUNT = 128;
+
+	static const float s_circleCorners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+	static const char* s_circleVertexSource = R"(
+		#version 150
+		uniform mat4 mvp;
+		uniform float depthScale;
+		in vec2 corner;
+		in vec4 centerRadiusOrder;
+		in vec4 color;
+		out vec2 fragOffset;
+		out float fragRadius;
+		out vec4 fragColor;
+		invariant gl_Position;
+		void main()
+		{
+			// Pad quad so anti-aliased edge is not cut off
+			fragOffset = corner * (centerRadiusOrder.z + 1.0);
+			fragRadius = centerRadiusOrder.z;
+			fragColor = color;
+			gl_Position = mvp * vec4(centerRadiusOrder.xy + fragOffset, 0.0, 1.0);
+			gl_Position.z = 1.0 - (centerRadiusOrder.w + 1.0) * depthScale;
+		}
+		)";
+
+	// Opaque pass only keeps fully covered fragments of opaque circles, the blended pass then
+	//	fails the depth test on those and only adds the anti-aliased edge
+	static const char* s_circleFragmentSource = R"(
+		#version 150
+		uniform int opaquePass;
+		in vec2 fragOffset;
+		in float fragRadius;
+		in vec4 fragColor;
+		out vec4 outColor;
+		void main()
+		{
+			float dist = length(fragOffset) - fragRadius;
+			float coverage = clamp(0.5 - dist / fwidth(dist), 0.0, 1.0);
+			if (opaquePass != 0 && fragColor.a * coverage < 1.0)
+				discard;
+			outColor = vec4(fragColor.rgb, fragColor.a * coverage);
+		}
+		)";
+
 	static void nk_clipbard_paste(nk_handle usr, nk_text_edit* edit)
 	{
 		const char* text = SDL_GetClipboardText();
@@ -89,11 +337,257 @@ namespace imGui
 		SDL_SetClipboardText(str.c_str());
 	}
 
+	struct InputState
+	{
+		vec2 mousePosition = vec2(0, 0);
+		vec2 mousePositionAtBegin = vec2(0, 0);
+		vec2 mouseDelta = vec2(0, 0);
+		float mouseScroll = 0;
+		bool buttonDown[(int)MouseButton::Count] = {};
+		bool buttonClicked[(int)MouseButton::Count] = {};
+		vec2 clickPosition[(int)MouseButton::Count];
+	};
+
+	static bool toMouseButton(uint8 sdlButton, MouseButton* button)
+	{
+		switch (sdlButton)
+		{
+			case SDL_BUTTON_LEFT: *button = MouseButton::Left; return true;
+			case SDL_BUTTON_MIDDLE: *button = MouseButton::Middle; return true;
+			case SDL_BUTTON_RIGHT: *button = MouseButton::Right; return true;
+			default: return false;
+		}
+	}
+
+	static nk_buttons toNkButton(MouseButton button)
+	{
+		static const nk_buttons nkButtons[] = { NK_BUTTON_LEFT, NK_BUTTON_MIDDLE, NK_BUTTON_RIGHT };
+		return nkButtons[(int)button];
+	}
+
 	// Stupid nk adds 0.5 to all coords
 	static struct nk_rect toNkRect(const Rect2& rect)
 	{
 		return nk_rect(rect.x - 0.5f, rect.y - 0.5f, rect.width(), rect.height());
 	}
+
+	// Orders map to depth in (-1, 1), later is nearer. Depth is only exact while orders fit in float mantissa
+	static const uint MAX_ORDER_COUNT = 1 << 22;
+
+	static float orderDepthScale(uint orderCount)
+	{
+		ASSERT_DESC(orderCount < MAX_ORDER_COUNT, "Too many IMGui primitives for depth ordering");
+		return 2.0f / (orderCount + 2);
+	}
+
+	// Copies triangles in reverse order, so geometry recorded back to front is drawn front to back
+	static void reverseTriangles(nk_draw_index* dest, const nk_draw_index* source, uint indexCount)
+	{
+		const uint triangleCount = indexCount / 3;
+		for (uint i = 0; i < triangleCount; ++i)
+		{
+			const nk_draw_index* const triangle = source + (triangleCount - 1 - i) * 3;
+			dest[i * 3 + 0] = triangle[0];
+			dest[i * 3 + 1] = triangle[1];
+			dest[i * 3 + 2] = triangle[2];
+		}
+	}
+
+	// Fewest segments that keep the sagitta of each chord under max error
+	static uint circleSegmentCount(float radiusPixels)
+	{
+		if (radiusPixels <= NATIVE_CIRCLE_MAX_ERROR)
+			return NATIVE_CIRCLE_MIN_SEGMENT_COUNT;
+		const float segmentCount = math::pi<float>() / math::acos(1.0f - NATIVE_CIRCLE_MAX_ERROR / radiusPixels);
+		return math::clamp((uint)math::ceil(segmentCount), NATIVE_CIRCLE_MIN_SEGMENT_COUNT, NATIVE_CIRCLE_MAX_SEGMENT_COUNT);
+	}
+
+	// Circle points are stepped by complex multiplication, avoiding sin/cos per vertex
+	static vec2 segmentRotation(uint segmentCount)
+	{
+		const float angle = 2.0f * math::pi<float>() / segmentCount;
+		return vec2(math::cos(angle), math::sin(angle));
+	}
+
+	static vec2 rotate(const vec2& v, const vec2& rotation)
+	{
+		return vec2(v.x * rotation.x - v.y * rotation.y, v.x * rotation.y + v.y * rotation.x);
+	}
+
+	static uint nativeVertexSize(IMGuiVertexFormat format)
+	{
+		return format == IMGuiVertexFormat::Compact ? sizeof(CompactVertex) : sizeof(NkVertex);
+	}
+
+	// Format is the same for a whole frame, so the branch is predictable
+	static void writeVertex(const NativeAllocation& a, uint index, const vec2& pos, const struct nk_vec2& uv, const vec4u8& color)
+	{
+		if (a.format == IMGuiVertexFormat::Compact)
+		{
+			// Primitives are clipped to compact range already, clamp only guards rounding
+			const vec2 subpixelPos = math::clamp(math::round(pos * COMPACT_SUBPIXEL_COUNT), vec2(-32768.0f), vec2(32767.0f));
+			const vec2 unormUv = math::round(math::clamp(vec2(uv.x, uv.y), vec2(0.0f), vec2(1.0f)) * COMPACT_UV_SCALE);
+			((CompactVertex*)a.vertices)[index] = CompactVertex{ { (int16)subpixelPos.x, (int16)subpixelPos.y }, 
+					{ (uint16)unormUv.x, (uint16)unormUv.y }, { color.x, color.y, color.z, color.w } };
+		}
+		else
+		{
+			((NkVertex*)a.vertices)[index] = NkVertex{ { pos.x, pos.y }, { uv.x, uv.y }, { color.x, color.y, color.z, color.w } };
+		}
+	}
+
+	static void decodeVertices(IMGuiCapture::Vertex* dest, const uint8* source, uint vertexCount, IMGuiVertexFormat format)
+	{
+		if (vertexCount == 0)
+			return;
+		if (format == IMGuiVertexFormat::Float)
+		{
+			memcpy(dest, source, vertexCount * sizeof(NkVertex));
+			return;
+		}
+
+		const CompactVertex* const vertices = (const CompactVertex*)source;
+		for (uint i = 0; i < vertexCount; ++i)
+		{
+			const CompactVertex& vertex = vertices[i];
+			dest[i].pos = vec2(vertex.pos[0], vertex.pos[1]) / COMPACT_SUBPIXEL_COUNT;
+			dest[i].uv = vec2(vertex.uv[0], vertex.uv[1]) / COMPACT_UV_SCALE;
+			dest[i].color = vec4u8(vertex.color[0], vertex.color[1], vertex.color[2], vertex.color[3]);
+		}
+	}
+
+	// Clamping the ends of an axis aligned span clips it, uvs follow the cut
+	static void clipSpanToCompactRange(float* p1, float* p2, float* uv1, float* uv2)
+	{
+		const float start = *p1;
+		const float length = *p2 - *p1;
+		const float uvStart = *uv1;
+		const float uvLength = *uv2 - *uv1;
+		*p1 = math::clamp(*p1, COMPACT_POS_MIN, COMPACT_POS_MAX);
+		*p2 = math::clamp(*p2, COMPACT_POS_MIN, COMPACT_POS_MAX);
+		if (length == 0.0f)
+			return;
+		*uv1 = uvStart + uvLength * (*p1 - start) / length;
+		*uv2 = uvStart + uvLength * (*p2 - start) / length;
+	}
+
+	static void writeQuad(const NativeAllocation& a, uint quadIndex, vec2 p1, vec2 p2, 
+			struct nk_vec2 uv1, struct nk_vec2 uv2, const vec4u8& color)
+	{
+		if (a.format == IMGuiVertexFormat::Compact)
+		{
+			clipSpanToCompactRange(&p1.x, &p2.x, &uv1.x, &uv2.x);
+			clipSpanToCompactRange(&p1.y, &p2.y, &uv1.y, &uv2.y);
+		}
+
+		const uint v = quadIndex * 4;
+		writeVertex(a, v + 0, p1, uv1, color);
+		writeVertex(a, v + 1, vec2(p2.x, p1.y), nk_vec2(uv2.x, uv1.y), color);
+		writeVertex(a, v + 2, p2, uv2, color);
+		writeVertex(a, v + 3, vec2(p1.x, p2.y), nk_vec2(uv1.x, uv2.y), color);
+
+		const nk_draw_index i = a.firstVertex + quadIndex * 4;
+		const nk_draw_index indices[] = { i, i + 1, i + 2, i, i + 2, i + 3 };
+		memcpy(a.indices + quadIndex * 6, indices, sizeof(indices));
+	}
+
+	// Keeps the part of a convex polygon where sign * pos[axis] <= sign * limit, adds at most one point
+	static uint clipPolygonSide(const vec2* points, uint count, vec2* out, int axis, float limit, float sign)
+	{
+		uint outCount = 0;
+		for (uint i = 0; i < count; ++i)
+		{
+			const vec2& p = points[i];
+			const vec2& next = points[(i + 1) % count];
+			const bool inside = sign * p[axis] <= sign * limit;
+			if (inside)
+				out[outCount++] = p;
+			if (inside != (sign * next[axis] <= sign * limit))
+			{
+				vec2 cut = p + (next - p) * ((limit - p[axis]) / (next[axis] - p[axis]));
+				cut[axis] = limit;
+				out[outCount++] = cut;
+			}
+		}
+		return outCount;
+	}
+
+	// Clips convex polygon in place, points and scratch need room for count + 4 points
+	static uint clipPolygonToCompactRange(vec2* points, uint count, vec2* scratch)
+	{
+		count = clipPolygonSide(points, count, scratch, 0, COMPACT_POS_MIN, -1.0f);
+		count = clipPolygonSide(scratch, count, points, 0, COMPACT_POS_MAX, 1.0f);
+		count = clipPolygonSide(points, count, scratch, 1, COMPACT_POS_MIN, -1.0f);
+		return clipPolygonSide(scratch, count, points, 1, COMPACT_POS_MAX, 1.0f);
+	}
+
+	// Fans polygon into fixed slots, unused slots repeat the first point and make degenerate triangles
+	static void writePolygonFan(const NativeAllocation& a, uint firstVertex, uint vertexCapacity, nk_draw_index* indices, 
+			const vec2* points, uint count, const struct nk_vec2& uv, const vec4u8& color)
+	{
+		for (uint i = 0; i < vertexCapacity; ++i)
+			writeVertex(a, firstVertex + i, count > 0 ? points[math::min(i, count - 1)] : vec2(0.0f), uv, color);
+
+		const nk_draw_index first = a.firstVertex + firstVertex;
+		for (uint i = 0; i + 2 < vertexCapacity; ++i)
+		{
+			const bool used = i + 2 < count;
+			indices[i * 3 + 0] = first;
+			indices[i * 3 + 1] = used ? first + i + 1 : first;
+			indices[i * 3 + 2] = used ? first + i + 2 : first;
+		}
+	}
+
+	static uint64 fontAtlasSourceHash()
+	{
+		const uint32 layout[] = { FONT_ATLAS_CACHE_VERSION, (uint32)sizeof(FontAtlasCacheHeader), 
+				(uint32)sizeof(nk_font_glyph), (uint32)sizeof(nk_rune), (uint32)NK_FONT_ATLAS_RGBA32 };
+		uint64 hash = hashMemory(nk_proggy_clean_ttf_compressed_data_base85, sizeof(nk_proggy_clean_ttf_compressed_data_base85));
+		hash = hashMemory(&DEFAULT_FONT_HEIGHT, sizeof(DEFAULT_FONT_HEIGHT), hash);
+		return hashMemory(layout, sizeof(layout), hash);
+	}
+
+	static int64 toMicroseconds(const Profiler::Duration& duration)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	}
+
+	// Lays out glyphs from origin the way nuklear draws text, without clamping
+	static void buildGlyphRun(GlyphRun* run)
+	{
+		const nk_user_font* font = run->font;
+		const char* text = run->text.data();
+		const int length = (int)run->text.size();
+
+		run->width = font->width(font->userdata, run->height, text, length);
+		run->quads.clear();
+
+		float x = 0.0f;
+		int textOffset = 0;
+		nk_rune unicode;
+		int glyphLength = nk_utf_decode(text, &unicode, length);
+		while (glyphLength > 0 && unicode != NK_UTF_INVALID)
+		{
+			nk_rune next = 0;
+			const int nextGlyphLength = nk_utf_decode(text + textOffset + glyphLength, &next, length - textOffset - glyphLength);
+
+			nk_user_font_glyph glyph;
+			font->query(font->userdata, run->height, &glyph, unicode, next == NK_UTF_INVALID ? '\0' : next);
+
+			GlyphQuad quad;
+			quad.p1 = vec2(x + glyph.offset.x, glyph.offset.y);
+			quad.p2 = quad.p1 + vec2(glyph.width, glyph.height);
+			quad.uv1 = glyph.uv[0];
+			quad.uv2 = glyph.uv[1];
+			x += glyph.xadvance;
+			quad.advanceEnd = x;
+			run->quads.push_back(quad);
+
+			textOffset += glyphLength;
+			glyphLength = nextGlyphLength;
+			unicode = next;
+		}
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -110,17 +604,154 @@ struct IMGuiImpl
 		Graphics::AttributeHandle colorAttribute;
 	};
 
-	struct Context 
+	struct CircleShaderInfo
+	{
+		owned_ptr<Graphics::Program> program;
+		Graphics::UniformHandle mvpUniform;
+		Graphics::AttributeHandle cornerAttribute;
+		Graphics::UniformHandle depthScaleUniform;
+		Graphics::UniformHandle opaquePassUniform;
+		Graphics::AttributeHandle centerRadiusOrderAttribute;
+		Graphics::AttributeHandle colorAttribute;
+	};
+
+	// Programs and font, shared by all layers
+	struct Resources
 	{
 		ShaderInfo shaderInfo;
-		nk_context nk;
-		nk_buffer nkCommands;
+		CircleShaderInfo circleShaderInfo;
+		ShaderInfo nativeShaderInfo;
+		Graphics::UniformHandle nativeOrderOffsetUniform;
+		Graphics::UniformHandle nativeDepthScaleUniform;
+		Graphics::UniformHandle nativePosScaleUniform;
 		nk_draw_null_texture nkNullTexture;
 		nk_font_atlas nkFontAtlas;
+		// Ranges of font loaded from cache, owned by nuklear when baked
+		vector<nk_rune> fontRanges;
 		Graphics::TextureHandle fontTexture;
+		const nk_user_font* font = nullptr;
+		Graphics::BufferHandle circleCornerBuffer;
+	};
+
+	// Nuklear context and geometry of a layer
+	struct Context 
+	{
+		nk_context nk;
+		nk_buffer nkCommands;
+		Graphics::AttributeBindingsHandle attributeBindings;
+		owned_ptr<Graphics::StreamBuffer> vertexStream;
+		owned_ptr<Graphics::StreamBuffer> indexStream;
+		// Attribute bindings have to be updated if stream buffer grows
+		Graphics::BufferHandle boundVertexBuffer;
+		uint boundVertexGeneration = 0;
+		IMGuiVertexFormat boundVertexFormat = IMGuiVertexFormat::Float;
+		uint vertexReservationSize;
+		uint indexReservationSize;
+		Graphics::AttributeBindingsHandle circleAttributeBindings;
+		owned_ptr<Graphics::StreamBuffer> circleInstanceStream;
+
+		// Converted into instead of stream buffers when capturing
+		vector<imGui::NkVertex> captureVertices;
+		vector<nk_draw_index> captureIndices;
+
+		// Geometry of last converted frame, reused as is while the nuklear commands hash the same
+		bool hasRetainedGeometry = false;
+		uint64 geometryHash;
+		uint vertexOffset;
+		uint vertexDataSize;
+		uint indexOffset;
+		uint indexDataSize;
+		vector<imGui::DrawBatch> drawBatches;
+		// Binds and draws of the draw batches, recorded with them and replayed while retained
+		owned_ptr<Graphics::CommandBuffer> drawCommands;
+		uint drawStateChangeCount;
+
+		bool hasRetainedCircles = false;
+		uint64 circleHash;
+		uint circleInstanceOffset;
+		uint circleInstanceDataSize;
+		// Instance attributes point at a specific offset, only re-stored when it changes
+		Graphics::BufferHandle circleBoundInstanceBuffer;
+		uint circleBoundInstanceGeneration = 0;
+		uint circleBoundInstanceOffset;
+	};
+
+	struct NativeContext
+	{
 		Graphics::AttributeBindingsHandle attributeBindings;
-		Graphics::BufferHandle vertexBuffer;
-		Graphics::BufferHandle indexBuffer;
+		owned_ptr<Graphics::StreamBuffer> vertexStream;
+		owned_ptr<Graphics::StreamBuffer> indexStream;
+		Graphics::BufferHandle boundVertexBuffer;
+		uint boundVertexGeneration = 0;
+		IMGuiVertexFormat boundVertexFormat = IMGuiVertexFormat::Float;
+		// Reservations are in bytes, so they hold more vertices in compact format
+		uint vertexReservationSize;
+		uint indexReservationSize;
+
+		// Format of current frame
+		IMGuiVertexFormat vertexFormat = IMGuiVertexFormat::Float;
+		uint vertexSize = sizeof(imGui::NkVertex);
+
+		// Chunk currently allocated from, chunk 0 stays mapped until render
+		uint chunk;
+		bool reserved = false;
+		uint8* chunk0Vertices;
+		nk_draw_index* chunk0Indices;
+		uint vertexCount;
+		// Blended indices count up from start of chunk, chunk 0 opaque ones are placed after them once recording ends
+		uint indexCount;
+		uint opaqueIndexCount;
+		uint vertexCapacity;
+		uint indexCapacity;
+
+		// Stream buffer offsets of each chunk once committed
+		uint vertexOffsets[2];
+		uint indexOffsets[2];
+		uint opaqueIndexOffsets[2];
+		uint chunk0VertexDataSize;
+		uint chunk0IndexDataSize;
+		uint chunk0OpaqueIndexCount;
+		// Committed bytes of each chunk, fenced again when drawn retained
+		uint vertexCommitSizes[2];
+		uint indexCommitSizes[2];
+
+		vector<uint8> spillVertices;
+		vector<nk_draw_index> spillIndices;
+		// Opaque indices of chunk 1 in call order, reversed when uploaded
+		vector<nk_draw_index> spillOpaqueIndices;
+		// Chunk 0 storage when capturing
+		vector<uint8> chunk0CaptureVertices;
+		vector<nk_draw_index> chunk0CaptureIndices;
+
+		vector<imGui::NativeBatch> batches;
+
+		// Primitives waiting for tessellation at render
+		vector<imGui::NativePrimitive> primitives;
+	};
+
+	// Layers are recorded and drawn independently, in z-order
+	//	A layer not begun in a frame keeps its recording, and is drawn again without being converted or uploaded
+	struct Layer
+	{
+		string name;
+		int zOrder;
+		// Backend the layer was last recorded with
+		IMGuiBackend backend = IMGuiBackend::Nuklear;
+		// Recorded since last drawn, clean layers reuse the geometry they were last drawn with
+		bool dirty = false;
+		// Recorded at least once since created or cleared
+		bool visible = false;
+		// Frame the layer was last begun, a layer can only be recorded once per frame
+		uint64 recordedFrame = 0;
+		// Hash of nuklear commands, taken when recording ends
+		uint64 commandHash = 0;
+		// Native layers often record no nuklear widgets, and need no nuklear stream buffers then
+		bool hasNuklearGeometry = false;
+		Context context;
+		NativeContext native;
+		vector<imGui::CircleInstance> circles;
+		uint opaqueCircleCount = 0;
+		nk_command_buffer* canvas = nullptr;
 	};
 
 	void setupStyle(not_null<nk_context*> ctx)
@@ -150,20 +781,51 @@ struct IMGuiImpl
 		style.button.text_active = nk_rgb(28,48,62);
 	}
 
-	IMGuiImpl()
+	IMGuiImpl(IMGuiOutput output)
 	{
-		using namespace Graphics;	
-		Context& ctx = this->context;
+		Resources& resources = this->resources;
+		this->output = output;
 
-		// Setup nk
-		nk_init_default(&ctx.nk, nullptr);
-		nk_buffer_init_default(&ctx.nkCommands);
-		ctx.nk.clip.copy = imGui::nk_clipbard_copy;
-		ctx.nk.clip.paste = imGui::nk_clipbard_paste;
-		ctx.nk.clip.userdata = nk_handle_ptr(nullptr);
+		if (output == IMGuiOutput::Graphics)
+			createGraphicsResources();
+
+		// Setup font
+		{
+			nk_font_atlas_init_default(&resources.nkFontAtlas);
+
+			const string preferencesPath = File::getPreferencesPath();
+			const string cachePath = preferencesPath.empty() ? string() : preferencesPath + imGui::FONT_ATLAS_CACHE_FILE_NAME;
+
+			const auto startTime = Profiler::getTime();
+			int64 bakeMicroseconds;
+			if (!cachePath.empty() && loadFontAtlasCache(cachePath.c_str(), &bakeMicroseconds))
+			{
+				const int64 loadMicroseconds = imGui::toMicroseconds(Profiler::getTime() - startTime);
+				PROFILER_COUNTER_ADD("IMGuiFontAtlasUs", loadMicroseconds);
+				PROFILER_COUNTER_ADD("IMGuiFontAtlasSavedUs", bakeMicroseconds - loadMicroseconds);
+				LOG("Loaded font atlas in " << loadMicroseconds << " us, baking took " << bakeMicroseconds << " us");
+			}
+			else
+			{
+				bakeFontAtlas(cachePath.empty() ? nullptr : cachePath.c_str());
+				PROFILER_COUNTER_ADD("IMGuiFontAtlasUs", imGui::toMicroseconds(Profiler::getTime() - startTime));
+			}
+
+    		nk_font_atlas_end(&resources.nkFontAtlas, nk_handle_id((int)resources.fontTexture), &resources.nkNullTexture);
+			if (resources.nkFontAtlas.default_font)
+				resources.font = &resources.nkFontAtlas.default_font->handle;
+		}
+
+		createLayer(imGui::DEFAULT_LAYER_NAME);
+	}
+
+	void createGraphicsResources()
+	{
+		using namespace Graphics;	
+		Resources& resources = this->resources;
 
 		// Setup 2d texture shader
-		ShaderInfo& shaderInfo = ctx.shaderInfo;
+		ShaderInfo& shaderInfo = resources.shaderInfo;
 		ProgramCreationParams programParams = { imGui::s_vertexSource, imGui::s_fragmentSource };
 		shaderInfo.program = createProgram(programParams);
 		shaderInfo.mvpUniform = fetchUniformHandle(shaderInfo.program, "mvp");
@@ -172,97 +834,1723 @@ struct IMGuiImpl
 		shaderInfo.uvAttribute = fetchAttributeHandle(shaderInfo.program, "uv");
 		shaderInfo.colorAttribute = fetchAttributeHandle(shaderInfo.program, "color");
 
-		// Setup shader attributes
-		ctx.vertexBuffer = createBuffer();
-		ctx.indexBuffer = createBuffer();		
-		const uint vertexSize = sizeof(imGui::NkVertex);
-		const uint posOffset = offsetof(imGui::NkVertex, pos);
-		const uint uvOffset = offsetof(imGui::NkVertex, uv);
-		const uint colorOffset = offsetof(imGui::NkVertex, color);
-		ctx.attributeBindings = createAttributeBindings();
-
-		const AttributeBindingInfo attributeInfos[] = {
-				{ shaderInfo.posAttribute, ctx.vertexBuffer, AttributeType::Float, 2, vertexSize, posOffset },
-				{ shaderInfo.uvAttribute, ctx.vertexBuffer, AttributeType::Float, 2, vertexSize, uvOffset },
-				{ shaderInfo.colorAttribute, ctx.vertexBuffer, AttributeType::NormalizedUInt8, 4, vertexSize, colorOffset }};
-		storeAttributeBindings(ctx.attributeBindings, attributeInfos);
-
-		// Setup font
+		// Setup native backend, vertex format is picked per frame
 		{
-			nk_font_atlas_init_default(&ctx.nkFontAtlas);
-			nk_font_atlas_begin(&ctx.nkFontAtlas);
-		
-			int width;
-			int height;
-			const void* fontImage = nk_font_atlas_bake(&ctx.nkFontAtlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+			ShaderInfo& nativeShaderInfo = resources.nativeShaderInfo;
+			ProgramCreationParams nativeProgramParams = { imGui::s_nativeVertexSource, imGui::s_fragmentSource };
+			nativeShaderInfo.program = createProgram(nativeProgramParams);
+			nativeShaderInfo.mvpUniform = fetchUniformHandle(nativeShaderInfo.program, "mvp");
+			nativeShaderInfo.texUniform = fetchUniformHandle(nativeShaderInfo.program, "tex");
+			nativeShaderInfo.posAttribute = fetchAttributeHandle(nativeShaderInfo.program, "pos");
+			nativeShaderInfo.uvAttribute = fetchAttributeHandle(nativeShaderInfo.program, "uv");
+			nativeShaderInfo.colorAttribute = fetchAttributeHandle(nativeShaderInfo.program, "color");
+			resources.nativeOrderOffsetUniform = fetchUniformHandle(nativeShaderInfo.program, "orderOffset");
+			resources.nativeDepthScaleUniform = fetchUniformHandle(nativeShaderInfo.program, "depthScale");
+			resources.nativePosScaleUniform = fetchUniformHandle(nativeShaderInfo.program, "posScale");
+		}
 
-			ctx.fontTexture = create2dTexture(width, height, fontImage);
+		// Setup batched circles
+		{
+			CircleShaderInfo& circleShaderInfo = resources.circleShaderInfo;
+			ProgramCreationParams circleProgramParams = { imGui::s_circleVertexSource, imGui::s_circleFragmentSource };
+			circleShaderInfo.program = createProgram(circleProgramParams);
+			circleShaderInfo.mvpUniform = fetchUniformHandle(circleShaderInfo.program, "mvp");
+			circleShaderInfo.cornerAttribute = fetchAttributeHandle(circleShaderInfo.program, "corner");
+			circleShaderInfo.depthScaleUniform = fetchUniformHandle(circleShaderInfo.program, "depthScale");
+			circleShaderInfo.opaquePassUniform = fetchUniformHandle(circleShaderInfo.program, "opaquePass");
+			circleShaderInfo.centerRadiusOrderAttribute = fetchAttributeHandle(circleShaderInfo.program, "centerRadiusOrder");
+			circleShaderInfo.colorAttribute = fetchAttributeHandle(circleShaderInfo.program, "color");
 
-    		nk_font_atlas_end(&ctx.nkFontAtlas, nk_handle_id((int)ctx.fontTexture), &ctx.nkNullTexture);
-			if (ctx.nkFontAtlas.default_font)
-				nk_style_set_font(&ctx.nk, &ctx.nkFontAtlas.default_font->handle);
+			resources.circleCornerBuffer = createBuffer();
+			uploadStaticVertexBufferData(resources.circleCornerBuffer, imGui::s_circleCorners, sizeof(imGui::s_circleCorners));
 		}
-
-		setupStyle(&ctx.nk);
 	}
 
-	~IMGuiImpl()
+	void destroyGraphicsResources()
 	{
 		using namespace Graphics;	
-		Context& ctx = this->context;
-		nk_font_atlas_clear(&ctx.nkFontAtlas);
-		nk_free(&ctx.nk);
-		nk_buffer_free(&ctx.nkCommands);
-		destroyProgram(std::move(ctx.shaderInfo.program));
-		destroyBuffer(ctx.vertexBuffer);
-		destroyBuffer(ctx.indexBuffer);
-		destroyAttributeBindings(ctx.attributeBindings);
-		destroyTexture(ctx.fontTexture);
+		Resources& resources = this->resources;
+		destroyProgram(std::move(resources.shaderInfo.program));
+		destroyTexture(resources.fontTexture);
+		destroyProgram(std::move(resources.circleShaderInfo.program));
+		destroyBuffer(resources.circleCornerBuffer);
+		destroyProgram(std::move(resources.nativeShaderInfo.program));
 	}
 
-	Context context;
-	nk_command_buffer* canvas = nullptr;
-	vec2 lastCanvasSize;
-};
+	Layer* createLayer(string_view name)
+	{
+		layers.push_back(make_unique<Layer>());
+		Layer& layer = *layers.back();
+		layer.name = name.to_string();
+		layer.zOrder = 0;
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Setup nk
+		Context& ctx = layer.context;
+		nk_init_default(&ctx.nk, resources.font);
+		nk_buffer_init_default(&ctx.nkCommands);
+		ctx.nk.clip.copy = imGui::nk_clipbard_copy;
+		ctx.nk.clip.paste = imGui::nk_clipbard_paste;
+		ctx.nk.clip.userdata = nk_handle_ptr(nullptr);
+		setupStyle(&ctx.nk);
 
-IMGui::IMGui()
-	: m_impl(make_unique<IMGuiImpl>())
-{
+		NativeContext& native = layer.native;
+		ctx.vertexReservationSize = imGui::INITIAL_VERTEX_COUNT * sizeof(imGui::NkVertex);
+		ctx.indexReservationSize = imGui::INITIAL_INDEX_COUNT * sizeof(nk_draw_index);
+		native.vertexReservationSize = imGui::INITIAL_VERTEX_COUNT * sizeof(imGui::NkVertex);
+		native.indexReservationSize = imGui::INITIAL_INDEX_COUNT * sizeof(nk_draw_index);
 
+		if (output == IMGuiOutput::Graphics)
+		{
+			// Stream buffers are created on first use, most layers only use some of them
+			using namespace Graphics;
+			ctx.attributeBindings = createAttributeBindings();
+			ctx.circleAttributeBindings = createAttributeBindings();
+			ctx.drawCommands = createCommandBuffer();
+			native.attributeBindings = createAttributeBindings();
+		}
 
-}
+		return &layer;
+	}
 
-IMGui::~IMGui()
-{
+	void destroyLayer(Layer* layer)
+	{
+		Context& ctx = layer->context;
+		nk_free(&ctx.nk);
+		nk_buffer_free(&ctx.nkCommands);
 
+		if (output == IMGuiOutput::Graphics)
+		{
+			using namespace Graphics;
+			NativeContext& native = layer->native;
+			for (owned_ptr<StreamBuffer>* stream : { &ctx.vertexStream, &ctx.indexStream, &ctx.circleInstanceStream, 
+					&native.vertexStream, &native.indexStream })
+			{
+				if (*stream)
+					destroyStreamBuffer(std::move(*stream));
+			}
+			destroyAttributeBindings(ctx.attributeBindings);
+			destroyAttributeBindings(ctx.circleAttributeBindings);
+			destroyCommandBuffer(std::move(ctx.drawCommands));
+			destroyAttributeBindings(native.attributeBindings);
+		}
+	}
 
-}
+	static void createStreamBufferOnce(owned_ptr<Graphics::StreamBuffer>* stream, Graphics::BufferTarget target, uint reservationSize)
+	{
+		if (!*stream)
+			*stream = Graphics::createStreamBuffer(target, reservationSize * imGui::STREAM_FRAME_COUNT);
+	}
+
+	Layer* findLayer(string_view name)
+	{
+		for (auto& layer : layers)
+		{
+			if (string_view(layer->name) == name)
+				return layer.get();
+		}
+		return nullptr;
+	}
+
+	// Layer primitives are recorded into
+	Layer& recordingLayer()
+	{
+		FATAL_ASSERT_DESC(layer && layer->canvas, "Primitives can only be drawn between beginFrame and endFrame");
+		return *layer;
+	}
+
+	void beginLayer(string_view name, int zOrder)
+	{
+		FATAL_ASSERT_DESC(frameOpen, "Layers can only be begun between beginFrame and endFrame");
+		Layer* layer = findLayer(name);
+		if (!layer)
+			layer = createLayer(name);
+		FATAL_ASSERT_DESC(layer->recordedFrame != frameNumber, "Layer can only be begun once per frame");
+
+		// Previous recording is kept until the layer is begun again
+		Context& ctx = layer->context;
+		nk_clear(&ctx.nk);
+		clearCircles(layer);
+		nk_begin(&ctx.nk, "imgui", imGui::toNkRect(Rect2(Point2(0, 0), lastCanvasSize)), NK_WINDOW_NO_SCROLLBAR);
+
+		layer->zOrder = zOrder;
+		layer->backend = frameBackend;
+		layer->dirty = true;
+		layer->visible = true;
+		layer->recordedFrame = frameNumber;
+		layer->canvas = nk_window_get_canvas(&ctx.nk);
+		layerStack.push_back(layer);
+		this->layer = layer;
+
+		if (layer->backend == IMGuiBackend::Native)
+			beginNative();
+	}
+
+	void endLayer()
+	{
+		FATAL_ASSERT_DESC(layerStack.size() > 0, "No layer to end");
+		Layer* layer = layerStack.back();
+		Context& ctx = layer->context;
+		nk_end(&ctx.nk);
+		layer->canvas = nullptr;
+
+		if (layer->backend == IMGuiBackend::Native)
+			endNativeRecording();
+
+		// Command offsets in draw order cover window ordering, which is not part of the command memory
+		const void* const commandMemory = nk_buffer_memory_const(&ctx.nk.memory);
+		uint64 hash = hashMemory(commandMemory, ctx.nk.memory.allocated);
+		bool hasGeometry = false;
+		const nk_command* cmd;
+		nk_foreach(cmd, &ctx.nk)
+		{
+			const size_t cmdOffset = (const uint8*)cmd - (const uint8*)commandMemory;
+			hash = hashMemory(&cmdOffset, sizeof(cmdOffset), hash);
+			hasGeometry = hasGeometry || (cmd->type != NK_COMMAND_NOP && cmd->type != NK_COMMAND_SCISSOR);
+		}
+		layer->commandHash = hash;
+		layer->hasNuklearGeometry = hasGeometry;
+
+		layerStack.pop_back();
+		this->layer = layerStack.size() > 0 ? layerStack.back() : nullptr;
+	}
+
+	// Visible layers from back to front, layers sharing z-order are drawn in order of creation
+	const vector<Layer*>& sortLayers()
+	{
+		drawOrder.clear();
+		for (auto& layer : layers)
+		{
+			if (layer->visible)
+				drawOrder.push_back(layer.get());
+		}
+		std::stable_sort(drawOrder.begin(), drawOrder.end(), [](const Layer* a, const Layer* b) { return a->zOrder < b->zOrder; });
+		return drawOrder;
+	}
+
+	Graphics::TextureHandle createFontTexture(int width, int height, const void* pixels)
+	{
+		if (output == IMGuiOutput::Capture)
+			return Graphics::TextureHandle(imGui::CAPTURE_FONT_TEXTURE);
+		return Graphics::create2dTexture(width, height, pixels);
+	}
+
+	void bakeFontAtlas(const char* cachePath)
+	{
+		PROFILER_SCOPE("IMGuiBakeFontAtlas", &kProfilerCategoryIMGui);
+
+		Resources& resources = this->resources;
+		nk_font_atlas* atlas = &resources.nkFontAtlas;
+		const auto startTime = Profiler::getTime();
+
+		nk_font_atlas_begin(atlas);
+		nk_font_atlas_add_default(atlas, imGui::DEFAULT_FONT_HEIGHT, nullptr);
+
+		int width;
+		int height;
+		const void* fontImage = nk_font_atlas_bake(atlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+		const int64 bakeMicroseconds = imGui::toMicroseconds(Profiler::getTime() - startTime);
+
+		resources.fontTexture = createFontTexture(width, height, fontImage);
+
+		if (cachePath && !saveFontAtlasCache(cachePath, fontImage, width, height, bakeMicroseconds))
+			LOG("Could not write font atlas cache to " << cachePath);
+	}
+
+	// Has to be called between bake and nk_font_atlas_end, which resets the atlas layout
+	bool saveFontAtlasCache(const char* path, const void* pixels, int width, int height, int64 bakeMicroseconds)
+	{
+		const nk_font_atlas& atlas = resources.nkFontAtlas;
+		if (atlas.font_num != 1 || !atlas.default_font)
+			return false;
+
+		const nk_font& font = *atlas.default_font;
+		uint rangeCount = 0;
+		while (font.info.ranges[rangeCount] != 0)
+			++rangeCount;
+		++rangeCount;
+
+		imGui::FontAtlasCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = imGui::FONT_ATLAS_CACHE_MAGIC;
+		header.version = imGui::FONT_ATLAS_CACHE_VERSION;
+		header.sourceHash = imGui::fontAtlasSourceHash();
+		header.bakeMicroseconds = bakeMicroseconds;
+		header.width = width;
+		header.height = height;
+		header.custom = atlas.custom;
+		memcpy(header.cursors, atlas.cursors, sizeof(header.cursors));
+		header.pixelHeight = font.handle.height;
+		header.bakedHeight = font.info.height;
+		header.ascent = font.info.ascent;
+		header.descent = font.info.descent;
+		header.fontGlyphOffset = font.info.glyph_offset;
+		header.fontGlyphCount = font.info.glyph_count;
+		header.fallbackCodepoint = font.fallback_codepoint;
+		header.rangeCount = rangeCount;
+		header.atlasGlyphCount = atlas.glyph_count;
+
+		const size_t rangesSize = rangeCount * sizeof(nk_rune);
+		const size_t glyphsSize = atlas.glyph_count * sizeof(nk_font_glyph);
+		const size_t pixelsSize = (size_t)width * height * 4;
+
+		vector<uint8> data(sizeof(header) + rangesSize + glyphsSize + pixelsSize);
+		uint8* dest = data.data();
+		memcpy(dest, &header, sizeof(header));
+		dest += sizeof(header);
+		memcpy(dest, font.info.ranges, rangesSize);
+		dest += rangesSize;
+		memcpy(dest, atlas.glyphs, glyphsSize);
+		dest += glyphsSize;
+		memcpy(dest, pixels, pixelsSize);
+
+		return File::writeFile(path, data.data(), data.size());
+	}
+
+	// Rebuilds atlas glyphs and default font without baking, texture is uploaded straight from the mapped file
+	bool loadFontAtlasCache(const char* path, int64* bakeMicroseconds)
+	{
+		PROFILER_SCOPE("IMGuiLoadFontAtlas", &kProfilerCategoryIMGui);
+
+		owned_ptr<File::MappedFile> file = File::mapFile(path);
+		if (!file)
+			return false;
+
+		SCOPE_EXIT( File::unmapFile(std::move(file)); );
+
+		const span<const uint8> data = File::getMappedFileData(file.get());
+		imGui::FontAtlasCacheHeader header;
+		if ((size_t)data.size() < sizeof(header))
+			return false;
+
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.magic != imGui::FONT_ATLAS_CACHE_MAGIC || header.version != imGui::FONT_ATLAS_CACHE_VERSION ||
+				header.sourceHash != imGui::fontAtlasSourceHash())
+			return false;
+
+		const size_t rangesSize = header.rangeCount * sizeof(nk_rune);
+		const size_t glyphsSize = header.atlasGlyphCount * sizeof(nk_font_glyph);
+		const size_t pixelsSize = (size_t)header.width * header.height * 4;
+		if (header.width <= 0 || header.height <= 0 || header.rangeCount == 0 || 
+				header.fontGlyphOffset > header.atlasGlyphCount || 
+				header.fontGlyphCount > header.atlasGlyphCount - header.fontGlyphOffset ||
+				(size_t)data.size() != sizeof(header) + rangesSize + glyphsSize + pixelsSize)
+		{
+			LOG("Ignoring invalid font atlas cache " << path);
+			return false;
+		}
+
+		Resources& resources = this->resources;
+		const uint8* src = data.data() + sizeof(header);
+		resources.fontRanges.resize(header.rangeCount);
+		memcpy(resources.fontRanges.data(), src, rangesSize);
+		src += rangesSize;
+		if (resources.fontRanges.back() != 0)
+			return false;
+
+		nk_font_atlas* atlas = &resources.nkFontAtlas;
+		atlas->glyphs = (nk_font_glyph*)atlas->permanent.alloc(atlas->permanent.userdata, nullptr, glyphsSize);
+		atlas->glyph_count = (int)header.atlasGlyphCount;
+		memcpy(atlas->glyphs, src, glyphsSize);
+		src += glyphsSize;
+
+		nk_baked_font bakedFont;
+		bakedFont.height = header.bakedHeight;
+		bakedFont.ascent = header.ascent;
+		bakedFont.descent = header.descent;
+		bakedFont.glyph_offset = header.fontGlyphOffset;
+		bakedFont.glyph_count = header.fontGlyphCount;
+		bakedFont.ranges = resources.fontRanges.data();
+
+		// Freed by nk_font_atlas_clear with the rest of the atlas
+		nk_font* font = (nk_font*)atlas->permanent.alloc(atlas->permanent.userdata, nullptr, sizeof(nk_font));
+		memset(font, 0, sizeof(*font));
+		nk_font_init(font, header.pixelHeight, header.fallbackCodepoint, atlas->glyphs, &bakedFont, nk_handle_id(0));
+		atlas->fonts = font;
+		atlas->default_font = font;
+		atlas->font_num = 1;
+
+		// Used by nk_font_atlas_end for null texture and cursors
+		atlas->tex_width = header.width;
+		atlas->tex_height = header.height;
+		atlas->custom = header.custom;
+		memcpy(atlas->cursors, header.cursors, sizeof(header.cursors));
+
+		resources.fontTexture = createFontTexture(header.width, header.height, src);
+
+		*bakeMicroseconds = header.bakeMicroseconds;
+		return true;
+	}
+
+	~IMGuiImpl()
+	{
+		for (auto& layer : layers)
+			destroyLayer(layer.get());
+		nk_font_atlas_clear(&resources.nkFontAtlas);
+		if (output == IMGuiOutput::Graphics)
+			destroyGraphicsResources();
+	}
+
+	// Attribute bindings have to be re-stored when the stream buffer has grown or the format changed
+	void updateVertexAttributeBindings(const ShaderInfo& shaderInfo, const Graphics::AttributeBindingsHandle& attributeBindings, 
+			not_null<const Graphics::StreamBuffer*> vertexStream, IMGuiVertexFormat format, 
+			Graphics::BufferHandle* boundVertexBuffer, uint* boundVertexGeneration, IMGuiVertexFormat* boundVertexFormat)
+	{
+		using namespace Graphics;
+
+		const BufferHandle vertexBuffer = getStreamBufferHandle(vertexStream);
+		const uint vertexGeneration = getStreamBufferGeneration(vertexStream);
+		if (vertexBuffer == *boundVertexBuffer && vertexGeneration == *boundVertexGeneration && format == *boundVertexFormat)
+			return;
+
+		if (format == IMGuiVertexFormat::Compact)
+		{
+			const uint vertexSize = sizeof(imGui::CompactVertex);
+			const AttributeBindingInfo attributeInfos[] = {
+					{ shaderInfo.posAttribute, vertexBuffer, AttributeType::Int16, 2, vertexSize, offsetof(imGui::CompactVertex, pos) },
+					{ shaderInfo.uvAttribute, vertexBuffer, AttributeType::NormalizedUInt16, 2, vertexSize, offsetof(imGui::CompactVertex, uv) },
+					{ shaderInfo.colorAttribute, vertexBuffer, AttributeType::NormalizedUInt8, 4, vertexSize, offsetof(imGui::CompactVertex, color) }};
+			storeAttributeBindings(attributeBindings, attributeInfos);
+		}
+		else
+		{
+			const uint vertexSize = sizeof(imGui::NkVertex);
+			const uint posOffset = offsetof(imGui::NkVertex, pos);
+			const uint uvOffset = offsetof(imGui::NkVertex, uv);
+			const uint colorOffset = offsetof(imGui::NkVertex, color);
+
+			const AttributeBindingInfo attributeInfos[] = {
+					{ shaderInfo.posAttribute, vertexBuffer, AttributeType::Float, 2, vertexSize, posOffset },
+					{ shaderInfo.uvAttribute, vertexBuffer, AttributeType::Float, 2, vertexSize, uvOffset },
+					{ shaderInfo.colorAttribute, vertexBuffer, AttributeType::NormalizedUInt8, 4, vertexSize, colorOffset }};
+			storeAttributeBindings(attributeBindings, attributeInfos);
+		}
+		*boundVertexBuffer = vertexBuffer;
+		*boundVertexGeneration = vertexGeneration;
+		*boundVertexFormat = format;
+	}
+
+	// Returns true if last uploaded instances were reused
+	bool uploadCircles()
+	{
+		using namespace Graphics;
+		Context& ctx = layer->context;
+		const auto& circles = layer->circles;
+
+		const uint instanceSize = sizeof(imGui::CircleInstance);
+		const uint instanceDataSize = circles.size() * instanceSize;
+		const uint64 hash = hashMemory(circles.data(), instanceDataSize);
+		if (ctx.hasRetainedCircles && hash == ctx.circleHash && instanceDataSize == ctx.circleInstanceDataSize)
+			return true;
+
+		createStreamBufferOnce(&ctx.circleInstanceStream, BufferTarget::Vertex, imGui::INITIAL_CIRCLE_COUNT * instanceSize);
+		void* const instanceData = reserveStreamBufferData(ctx.circleInstanceStream, instanceDataSize, instanceSize);
+		memcpy(instanceData, circles.data(), instanceDataSize);
+		ctx.circleInstanceOffset = commitStreamBufferData(ctx.circleInstanceStream, instanceDataSize);
+
+		ctx.hasRetainedCircles = true;
+		ctx.circleHash = hash;
+		ctx.circleInstanceDataSize = instanceDataSize;
+		return false;
+	}
+
+	// Circle program has to be bound
+	void drawCircles(uint firstInstance, uint instanceCount)
+	{
+		using namespace Graphics;
+		Context& ctx = layer->context;
+		const CircleShaderInfo& circleShaderInfo = resources.circleShaderInfo;
+
+		// No base instance in GL 3.3, so instance attributes point at the first instance directly
+		const uint instanceSize = sizeof(imGui::CircleInstance);
+		const BufferHandle instanceBuffer = getStreamBufferHandle(ctx.circleInstanceStream.get());
+		const uint instanceGeneration = getStreamBufferGeneration(ctx.circleInstanceStream.get());
+		const uint instanceOffset = ctx.circleInstanceOffset + firstInstance * instanceSize;
+		if (instanceBuffer != ctx.circleBoundInstanceBuffer || instanceGeneration != ctx.circleBoundInstanceGeneration || 
+				instanceOffset != ctx.circleBoundInstanceOffset)
+		{
+			const uint centerRadiusOrderOffset = instanceOffset + offsetof(imGui::CircleInstance, center);
+			const uint colorOffset = instanceOffset + offsetof(imGui::CircleInstance, color);
+			const AttributeBindingInfo circleAttributeInfos[] = {
+					{ circleShaderInfo.cornerAttribute, resources.circleCornerBuffer, AttributeType::Float, 2, sizeof(float) * 2, 0, 0 },
+					{ circleShaderInfo.centerRadiusOrderAttribute, instanceBuffer, AttributeType::Float, 4, instanceSize, centerRadiusOrderOffset, 1 },
+					{ circleShaderInfo.colorAttribute, instanceBuffer, AttributeType::NormalizedUInt8, 4, instanceSize, colorOffset, 1 }};
+			storeAttributeBindings(ctx.circleAttributeBindings, circleAttributeInfos);
+			ctx.circleBoundInstanceBuffer = instanceBuffer;
+			ctx.circleBoundInstanceGeneration = instanceGeneration;
+			ctx.circleBoundInstanceOffset = instanceOffset;
+		}
+
+		bindAttributes(ctx.circleAttributeBindings);
+		drawInstanced(PrimitiveType::TriangleStrip, 4, instanceCount);
+	}
+
+	void fenceCircles(bool retained)
+	{
+		using namespace Graphics;
+		Context& ctx = layer->context;
+		if (retained)
+			fenceStreamBufferRange(ctx.circleInstanceStream, ctx.circleInstanceOffset, ctx.circleInstanceDataSize);
+		else
+			fenceStreamBufferData(ctx.circleInstanceStream);
+	}
+
+	// Opaque circle centers first with depth writes, then all circles blended, which skips the covered centers
+	void renderCircles(const mat4& projMatrix)
+	{
+		using namespace Graphics;
+		const auto& circles = layer->circles;
+
+		const bool retained = uploadCircles();
+		const float depthScale = imGui::orderDepthScale(circles.size());
+
+		setDepthTestMode(DepthTestMode::Enabled);
+		if (layer->opaqueCircleCount > 0)
+		{
+			setBlendMode(BlendMode::Disabled);
+			setDepthWriteMode(DepthWriteMode::Enabled);
+			bindCircleProgram(projMatrix, depthScale, true);
+			drawCircles(0, circles.size());
+		}
+
+		setBlendMode(BlendMode::AlphaBlend);
+		setDepthWriteMode(DepthWriteMode::Disabled);
+		bindCircleProgram(projMatrix, depthScale, false);
+		drawCircles(0, circles.size());
+
+		setDepthWriteMode(DepthWriteMode::Enabled);
+		setDepthTestMode(DepthTestMode::Disabled);
+		fenceCircles(retained);
+	}
+
+	void beginNative()
+	{
+		using namespace Graphics;
+		NativeContext& native = layer->native;
+		ASSERT_DESC(!native.reserved, "Native layer has to be rendered before it is recorded again");
+
+		native.chunk = 0;
+		native.vertexFormat = vertexFormat;
+		native.vertexSize = imGui::nativeVertexSize(vertexFormat);
+		if (output == IMGuiOutput::Capture)
+		{
+			native.chunk0CaptureVertices.resize(native.vertexReservationSize);
+			native.chunk0CaptureIndices.resize(native.indexReservationSize / sizeof(nk_draw_index));
+			native.chunk0Vertices = native.chunk0CaptureVertices.data();
+			native.chunk0Indices = native.chunk0CaptureIndices.data();
+		}
+		else
+		{
+			createStreamBufferOnce(&native.vertexStream, BufferTarget::Vertex, native.vertexReservationSize);
+			createStreamBufferOnce(&native.indexStream, BufferTarget::Index, native.indexReservationSize);
+			native.chunk0Vertices = (uint8*)reserveStreamBufferData(native.vertexStream, native.vertexReservationSize, native.vertexSize).get();
+			native.chunk0Indices = (nk_draw_index*)reserveStreamBufferData(native.indexStream, native.indexReservationSize, sizeof(nk_draw_index)).get();
+		}
+		native.reserved = true;
+		native.vertexCount = 0;
+		native.indexCount = 0;
+		native.opaqueIndexCount = 0;
+		native.vertexCapacity = native.vertexReservationSize / native.vertexSize;
+		native.indexCapacity = native.indexReservationSize / sizeof(nk_draw_index);
+		native.batches.clear();
+		native.primitives.clear();
+	}
+
+	void commitNativeChunk0()
+	{
+		using namespace Graphics;
+		NativeContext& native = layer->native;
+		if (!native.reserved)
+			return;
+
+		// Opaque indices follow the blended ones
+		native.vertexCommitSizes[0] = native.chunk0VertexDataSize;
+		native.indexCommitSizes[0] = native.chunk0IndexDataSize + native.chunk0OpaqueIndexCount * sizeof(nk_draw_index);
+		native.vertexCommitSizes[1] = 0;
+		native.indexCommitSizes[1] = 0;
+		if (output == IMGuiOutput::Graphics)
+		{
+			native.vertexOffsets[0] = commitStreamBufferData(native.vertexStream, native.vertexCommitSizes[0]);
+			native.indexOffsets[0] = commitStreamBufferData(native.indexStream, native.indexCommitSizes[0]);
+		}
+		else
+		{
+			native.indexOffsets[0] = 0;
+		}
+		native.opaqueIndexOffsets[0] = native.indexOffsets[0] + native.chunk0IndexDataSize;
+		native.reserved = false;
+	}
+
+	// Chunk 0 opaque indices are placed by the final counts, so recording has to end before tessellation
+	void endNativeRecording()
+	{
+		if (layer->native.chunk == 0)
+			finishNativeChunk0();
+	}
+
+	void finishNativeChunk0()
+	{
+		NativeContext& native = layer->native;
+		native.chunk0VertexDataSize = native.vertexCount * native.vertexSize;
+		native.chunk0IndexDataSize = native.indexCount * sizeof(nk_draw_index);
+		native.chunk0OpaqueIndexCount = native.opaqueIndexCount;
+	}
+
+	// Reservation ran out, continue in CPU side storage which is uploaded at render
+	void spillNative(uint vertexCount, uint indexCount)
+	{
+		NativeContext& native = layer->native;
+		if (native.chunk == 0)
+		{
+			finishNativeChunk0();
+			native.chunk = 1;
+			native.vertexCount = 0;
+			native.indexCount = 0;
+			native.opaqueIndexCount = 0;
+		}
+
+		native.vertexCapacity = math::max(native.vertexCapacity * 2, native.vertexCount + vertexCount);
+		native.indexCapacity = math::max(native.indexCapacity * 2, native.indexCount + native.opaqueIndexCount + indexCount);
+		native.spillVertices.resize(native.vertexCapacity * native.vertexSize);
+		native.spillIndices.resize(native.indexCapacity);
+		native.spillOpaqueIndices.resize(native.indexCapacity);
+	}
+
+	// Opaque triangles are drawn in a pass of their own and do not break batches
+	imGui::NativeRange allocateNativeTriangles(uint vertexCount, uint indexCount, bool opaque)
+	{
+		NativeContext& native = recordingLayer().native;
+		if (native.vertexCount + vertexCount > native.vertexCapacity || 
+				native.indexCount + native.opaqueIndexCount + indexCount > native.indexCapacity)
+			spillNative(vertexCount, indexCount);
+
+		imGui::NativeRange range = { native.chunk, native.vertexCount, native.indexCount, opaque };
+		if (opaque)
+		{
+			// Chunk 0 opaque indices go after the blended ones front to back, counted from their end until the counts are final
+			range.firstIndex = native.chunk == 0 ? native.opaqueIndexCount + indexCount : native.opaqueIndexCount;
+			native.opaqueIndexCount += indexCount;
+		}
+		else if (indexCount > 0)
+		{
+			auto& batches = native.batches;
+			if (batches.size() > 0 && batches.back().type == imGui::NativeBatchType::Triangles && batches.back().chunk == native.chunk)
+				batches.back().count += indexCount;
+			else
+				batches.push_back(imGui::NativeBatch{ imGui::NativeBatchType::Triangles, native.chunk, native.indexCount, indexCount });
+			native.indexCount += indexCount;
+		}
+
+		native.vertexCount += vertexCount;
+		return range;
+	}
+
+	// Spill storage may move while recording, so only resolve once done allocating
+	imGui::NativeAllocation resolveNativeRange(const imGui::NativeRange& range)
+	{
+		NativeContext& native = layer->native;
+		uint8* const vertices = range.chunk == 0 ? native.chunk0Vertices : native.spillVertices.data();
+		nk_draw_index* const indices = range.chunk == 0 ? native.chunk0Indices : 
+				(range.opaque ? native.spillOpaqueIndices.data() : native.spillIndices.data());
+		uint firstIndex = range.firstIndex;
+		if (range.chunk == 0 && range.opaque)
+			firstIndex = native.chunk0IndexDataSize / sizeof(nk_draw_index) + native.chunk0OpaqueIndexCount - range.firstIndex;
+		return imGui::NativeAllocation{ vertices + range.firstVertex * native.vertexSize, native.vertexFormat, 
+				indices + firstIndex, range.firstVertex };
+	}
+
+	// Order of a vertex in the frame, used for depth
+	uint nativeVertexOrder(uint chunk, uint vertex) const
+	{
+		const NativeContext& native = layer->native;
+		return chunk == 0 ? vertex : native.chunk0VertexDataSize / native.vertexSize + vertex;
+	}
+
+	// Circles have no vertices, so each takes a vertex slot that is never written, and is ordered as that vertex
+	void addNativeCircle(imGui::CircleInstance circle)
+	{
+		const imGui::NativeRange range = allocateNativeTriangles(1, 0, false);
+		circle.order = (float)nativeVertexOrder(range.chunk, range.firstVertex);
+
+		auto& batches = layer->native.batches;
+		if (batches.size() > 0 && batches.back().type == imGui::NativeBatchType::Circles)
+			batches.back().count++;
+		else
+			batches.push_back(imGui::NativeBatch{ imGui::NativeBatchType::Circles, 0, (uint)layer->circles.size(), 1 });
+		addCircle(circle);
+	}
+
+	// Tessellated at render, once placement of opaque indices is known
+	void addNativePrimitive(const imGui::NativePrimitive& primitive)
+	{
+		layer->native.primitives.push_back(primitive);
+	}
+
+	bool nativeOffCanvas(const vec2& min, const vec2& max) const
+	{
+		return max.x < 0.0f || max.y < 0.0f || min.x > lastCanvasSize.x || min.y > lastCanvasSize.y;
+	}
+
+	bool nativeOutsideCompactRange(const vec2& min, const vec2& max) const
+	{
+		return layer->native.vertexFormat == IMGuiVertexFormat::Compact && 
+				(min.x < imGui::COMPACT_POS_MIN || min.y < imGui::COMPACT_POS_MIN || 
+				max.x > imGui::COMPACT_POS_MAX || max.y > imGui::COMPACT_POS_MAX);
+	}
+
+	// Quads are clipped to compact range when written, so rects and text only need culling
+	void nativeRect(const vec2& p1, const vec2& p2, const vec4u8& color)
+	{
+		if (nativeOffCanvas(math::min(p1, p2), math::max(p1, p2)))
+			return;
+
+		imGui::NativePrimitive primitive;
+		primitive.type = imGui::NativePrimitiveType::Rect;
+		primitive.range = allocateNativeTriangles(4, 6, color.w == 255);
+		primitive.color = color;
+		primitive.p1 = p1;
+		primitive.p2 = p2;
+		addNativePrimitive(primitive);
+	}
+
+	uint nativeCircleSegmentCount(float radius) const
+	{
+		return imGui::circleSegmentCount(radius * math::max(pixelScale.x, pixelScale.y));
+	}
+
+	void nativeFilledCircle(const vec2& center, float radius, const vec4u8& color)
+	{
+		if (nativeOffCanvas(center - radius, center + radius))
+			return;
+
+		const uint segmentCount = nativeCircleSegmentCount(radius);
+		imGui::NativePrimitive primitive;
+		primitive.type = imGui::NativePrimitiveType::FilledCircle;
+		primitive.clipped = nativeOutsideCompactRange(center - radius, center + radius);
+		primitive.range = primitive.clipped ? 
+				allocateNativeTriangles(segmentCount + 4, (segmentCount + 2) * 3, color.w == 255) : 
+				allocateNativeTriangles(segmentCount + 1, segmentCount * 3, color.w == 255);
+		primitive.color = color;
+		primitive.p1 = center;
+		primitive.p2 = vec2(radius, 0.0f);
+		primitive.segmentCount = segmentCount;
+		addNativePrimitive(primitive);
+	}
+
+	void nativeStrokedCircle(const vec2& center, float radius, float lineWidth, const vec4u8& color)
+	{
+		const float outerRadius = radius + lineWidth * 0.5f;
+		if (nativeOffCanvas(center - outerRadius, center + outerRadius))
+			return;
+
+		// Clipped segments are quads cut by up to four sides
+		const uint segmentCount = nativeCircleSegmentCount(outerRadius);
+		imGui::NativePrimitive primitive;
+		primitive.type = imGui::NativePrimitiveType::StrokedCircle;
+		primitive.clipped = nativeOutsideCompactRange(center - outerRadius, center + outerRadius);
+		primitive.range = primitive.clipped ? 
+				allocateNativeTriangles(segmentCount * 8, segmentCount * 18, color.w == 255) : 
+				allocateNativeTriangles(segmentCount * 2, segmentCount * 6, color.w == 255);
+		primitive.color = color;
+		primitive.p1 = center;
+		primitive.p2 = vec2(radius, lineWidth);
+		primitive.segmentCount = segmentCount;
+		addNativePrimitive(primitive);
+	}
+
+	// Cached runs stay put until evicted at beginFrame, so deferred primitives can point at them
+	const imGui::GlyphRun* getGlyphRun(const nk_user_font* font, string_view text)
+	{
+		const float height = font->height;
+		uint64 key = hashMemory(&font, sizeof(font));
+		key = hashMemory(&height, sizeof(height), key);
+		key = hashMemory(text.data(), text.size(), key);
+
+		auto it = glyphRuns.find(key);
+		if (it != glyphRuns.end())
+		{
+			imGui::GlyphRun& run = it->second;
+			if (run.font == font && run.height == height && string_view(run.text) == text)
+			{
+				run.lastUsedFrame = frameNumber;
+				return &run;
+			}
+
+			// Hash collision, keep run if it may be referenced this frame
+			if (run.lastUsedFrame == frameNumber)
+			{
+				uncachedGlyphRuns.push_back(imGui::GlyphRun{ text.to_string(), font, height, 0.0f, {}, frameNumber });
+				imGui::buildGlyphRun(&uncachedGlyphRuns.back());
+				return &uncachedGlyphRuns.back();
+			}
+		}
+
+		imGui::GlyphRun& run = glyphRuns[key];
+		run.text = text.to_string();
+		run.font = font;
+		run.height = height;
+		run.lastUsedFrame = frameNumber;
+		imGui::buildGlyphRun(&run);
+		PROFILER_COUNTER_ADD("IMGuiGlyphRunMisses", 1);
+		return &run;
+	}
+
+	void evictGlyphRuns()
+	{
+		++frameNumber;
+		uncachedGlyphRuns.clear();
+		if (frameNumber % imGui::GLYPH_RUN_EVICTION_INTERVAL != 0)
+			return;
+
+		for (auto it = glyphRuns.begin(); it != glyphRuns.end();)
+		{
+			if (it->second.lastUsedFrame + imGui::GLYPH_RUN_MAX_UNUSED_FRAMES < frameNumber)
+				it = glyphRuns.erase(it);
+			else
+				++it;
+		}
+	}
+
+	// Lays out text like nuklear's centered widget text, one quad per glyph
+	void nativeText(const Rect2& rect, string_view text, const vec4u8& color)
+	{
+		const nk_style& style = recordingLayer().context.nk.style;
+		const nk_user_font* font = style.font;
+		const struct nk_vec2 padding = style.text.padding;
+		const imGui::GlyphRun* run = getGlyphRun(font, text);
+
+		const float labelWidth = math::max(1.0f, 2.0f * padding.x + run->width);
+		const float labelX = math::max(rect.x + padding.x, rect.x + padding.x + ((rect.width() - 2.0f * padding.x) - labelWidth) / 2.0f);
+		const float labelX2 = math::min(rect.x2, labelX + labelWidth);
+		const float labelY = rect.y + rect.height() / 2.0f - font->height / 2.0f;
+
+		// Clamp to label like nuklear does
+		const float clampWidth = labelX2 - labelX + 0.5f;
+		uint glyphCount = 0;
+		while (glyphCount < run->quads.size() && run->quads[glyphCount].advanceEnd <= clampWidth)
+			++glyphCount;
+		if (glyphCount == 0 || nativeOffCanvas(vec2(labelX, labelY), vec2(labelX2, labelY + font->height)))
+			return;
+
+		imGui::NativePrimitive primitive;
+		primitive.type = imGui::NativePrimitiveType::Text;
+		primitive.range = allocateNativeTriangles(glyphCount * 4, glyphCount * 6, false);
+		primitive.color = color;
+		primitive.p1 = vec2(labelX, labelY);
+		primitive.segmentCount = glyphCount;
+		primitive.glyphRun = run;
+		addNativePrimitive(primitive);
+	}
+
+	// Writes geometry of primitive into its allocated range, safe to call from workers
+	void tessellateNativePrimitive(const imGui::NativePrimitive& primitive)
+	{
+		const imGui::NativeAllocation a = resolveNativeRange(primitive.range);
+		const struct nk_vec2 uv = resources.nkNullTexture.uv;
+		switch (primitive.type)
+		{
+			case imGui::NativePrimitiveType::Rect:
+			{
+				imGui::writeQuad(a, 0, primitive.p1, primitive.p2, uv, uv, primitive.color);
+				break;
+			}
+			case imGui::NativePrimitiveType::FilledCircle:
+			{
+				// Triangle fan around center
+				const uint segmentCount = primitive.segmentCount;
+				const vec2& center = primitive.p1;
+				const float radius = primitive.p2.x;
+				const vec2 rotation = imGui::segmentRotation(segmentCount);
+				vec2 direction = vec2(1.0f, 0.0f);
+				if (primitive.clipped)
+				{
+					vec2 points[imGui::NATIVE_CIRCLE_MAX_SEGMENT_COUNT + 4];
+					vec2 scratch[imGui::NATIVE_CIRCLE_MAX_SEGMENT_COUNT + 4];
+					for (uint i = 0; i < segmentCount; ++i)
+					{
+						points[i] = center + direction * radius;
+						direction = imGui::rotate(direction, rotation);
+					}
+					const uint pointCount = imGui::clipPolygonToCompactRange(points, segmentCount, scratch);
+					imGui::writePolygonFan(a, 0, segmentCount + 4, a.indices, points, pointCount, uv, primitive.color);
+					break;
+				}
+
+				imGui::writeVertex(a, 0, center, uv, primitive.color);
+				for (uint i = 0; i < segmentCount; ++i)
+				{
+					imGui::writeVertex(a, i + 1, center + direction * radius, uv, primitive.color);
+					direction = imGui::rotate(direction, rotation);
+					a.indices[i * 3 + 0] = a.firstVertex;
+					a.indices[i * 3 + 1] = a.firstVertex + 1 + i;
+					a.indices[i * 3 + 2] = a.firstVertex + 1 + (i + 1) % segmentCount;
+				}
+				break;
+			}
+			case imGui::NativePrimitiveType::StrokedCircle:
+			{
+				// Ring of quads straddling the radius
+				const uint segmentCount = primitive.segmentCount;
+				const vec2& center = primitive.p1;
+				const float innerRadius = math::max(primitive.p2.x - primitive.p2.y * 0.5f, 0.0f);
+				const float outerRadius = primitive.p2.x + primitive.p2.y * 0.5f;
+				const vec2 rotation = imGui::segmentRotation(segmentCount);
+				vec2 direction = vec2(1.0f, 0.0f);
+				if (primitive.clipped)
+				{
+					for (uint i = 0; i < segmentCount; ++i)
+					{
+						const vec2 nextDirection = imGui::rotate(direction, rotation);
+						vec2 points[8] = { center + direction * innerRadius, center + direction * outerRadius, 
+								center + nextDirection * outerRadius, center + nextDirection * innerRadius };
+						vec2 scratch[8];
+						const uint pointCount = imGui::clipPolygonToCompactRange(points, 4, scratch);
+						imGui::writePolygonFan(a, i * 8, 8, a.indices + i * 18, points, pointCount, uv, primitive.color);
+						direction = nextDirection;
+					}
+					break;
+				}
+
+				for (uint i = 0; i < segmentCount; ++i)
+				{
+					imGui::writeVertex(a, i * 2 + 0, center + direction * innerRadius, uv, primitive.color);
+					imGui::writeVertex(a, i * 2 + 1, center + direction * outerRadius, uv, primitive.color);
+					direction = imGui::rotate(direction, rotation);
+
+					const nk_draw_index inner = a.firstVertex + i * 2;
+					const nk_draw_index nextInner = a.firstVertex + ((i + 1) % segmentCount) * 2;
+					nk_draw_index* const indices = a.indices + i * 6;
+					indices[0] = inner;
+					indices[1] = inner + 1;
+					indices[2] = nextInner + 1;
+					indices[3] = inner;
+					indices[4] = nextInner + 1;
+					indices[5] = nextInner;
+				}
+				break;
+			}
+			case imGui::NativePrimitiveType::Text:
+			{
+				const vec2& origin = primitive.p1;
+				for (uint i = 0; i < primitive.segmentCount; ++i)
+				{
+					const imGui::GlyphQuad& quad = primitive.glyphRun->quads[i];
+					imGui::writeQuad(a, i, origin + quad.p1, origin + quad.p2, quad.uv1, quad.uv2, primitive.color);
+				}
+				break;
+			}
+		}
+	}
+
+	// Tessellates recorded primitives, split over workers if there are enough of them
+	void tessellateNative()
+	{
+		NativeContext& native = layer->native;
+		const auto& primitives = native.primitives;
+		if (primitives.size() == 0)
+			return;
+
+		PROFILER_SCOPE("IMGuiTessellate", &kProfilerCategoryIMGui);
+		const uint primitiveCount = primitives.size();
+		const uint maxJobCount = workers ? (workers->getWorkerCount() + 1) * imGui::NATIVE_JOBS_PER_THREAD : 1;
+		const uint jobCount = math::min(maxJobCount, 
+				(primitiveCount + imGui::NATIVE_MIN_PRIMITIVES_PER_JOB - 1) / imGui::NATIVE_MIN_PRIMITIVES_PER_JOB);
+
+		if (jobCount <= 1)
+		{
+			for (const auto& primitive : primitives)
+				tessellateNativePrimitive(primitive);
+			return;
+		}
+
+		workers->parallelFor(jobCount, [&](uint job)
+		{
+			PROFILER_SCOPE("IMGuiTessellateJob", &kProfilerCategoryIMGui);
+			const uint begin = (uint)((uint64)primitiveCount * job / jobCount);
+			const uint end = (uint)((uint64)primitiveCount * (job + 1) / jobCount);
+			for (uint i = begin; i < end; ++i)
+				tessellateNativePrimitive(primitives[i]);
+		});
+	}
+
+	// Converts nuklear commands into given memory, grows reservations and returns false if it did not fit
+	bool convertNuklear(void* vertices, void* indices)
+	{
+		Context& ctx = layer->context;
+
+		/* fill convert configuration */
+		static const nk_draw_vertex_layout_element vertex_layout[] = {
+			{NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(imGui::NkVertex, pos)},
+			{NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(imGui::NkVertex, uv)},
+			{NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(imGui::NkVertex, color)},
+			{NK_VERTEX_LAYOUT_END}};
+
+		nk_convert_config config;
+		NK_MEMSET(&config, 0, sizeof(config));
+		config.vertex_layout = vertex_layout;
+		config.vertex_size = sizeof(imGui::NkVertex);
+		config.vertex_alignment = NK_ALIGNOF(imGui::NkVertex);
+		config.null = resources.nkNullTexture;
+		config.circle_segment_count = 32;
+		config.curve_segment_count = 32;
+		config.arc_segment_count = 32;
+		config.global_alpha = 1.0f;
+		config.shape_AA = NK_ANTI_ALIASING_OFF;
+		config.line_AA = NK_ANTI_ALIASING_OFF;
+
+		nk_buffer_clear(&ctx.nkCommands);
+
+		/* setup buffers to load vertices and elements */
+		nk_buffer vbuf, ibuf;
+		nk_buffer_init_fixed(&vbuf, vertices, (nk_size)ctx.vertexReservationSize);
+		nk_buffer_init_fixed(&ibuf, indices, (nk_size)ctx.indexReservationSize);
+		const nk_flags result = nk_convert(&ctx.nk, &ctx.nkCommands, &vbuf, &ibuf, &config);
+
+		if (!(result & (NK_CONVERT_VERTEX_BUFFER_FULL | NK_CONVERT_ELEMENT_BUFFER_FULL)))
+		{
+			ctx.vertexDataSize = (uint)vbuf.needed;
+			ctx.indexDataSize = (uint)ibuf.needed;
+			return true;
+		}
+
+		if (result & NK_CONVERT_VERTEX_BUFFER_FULL)
+			ctx.vertexReservationSize = math::max(ctx.vertexReservationSize * 2, (uint)vbuf.needed);
+		if (result & NK_CONVERT_ELEMENT_BUFFER_FULL)
+			ctx.indexReservationSize = math::max(ctx.indexReservationSize * 2, (uint)ibuf.needed);
+		LOG("Growing IMGui reservations to " << ctx.vertexReservationSize << " vertex bytes, " 
+				<< ctx.indexReservationSize << " index bytes");
+
+		// Reset draw commands from the failed conversion
+		nk_draw_list_clear(&ctx.nk.draw_list);
+		return false;
+	}
+
+	// Draw batches of converted commands, starting at index offset of converted data
+	void buildDrawBatches(const vec2& scale)
+	{
+		using namespace Graphics;
+		Context& ctx = layer->context;
+		const vec2& canvasSize = lastCanvasSize;
+
+		// Adjacent commands sharing texture and clip area are merged into a single draw
+		//	Commands are not reordered, overlapping translucent geometry depends on painter's order
+		auto& drawBatches = ctx.drawBatches;
+		drawBatches.clear();
+		uint offset = ctx.indexOffset;
+		for(const nk_draw_command* cmd = nk__draw_begin(&ctx.nk, &ctx.nkCommands); 
+				cmd != nullptr; 
+				cmd = nk__draw_next(cmd, &ctx.nkCommands, &ctx.nk))
+		{
+			const uint cmdOffset = offset;
+			offset += cmd->elem_count * sizeof(nk_draw_index);
+			if (!cmd->elem_count) 
+				continue;
+
+			// Clamp to canvas so unbounded clip areas compare equal, fully clipped commands are dropped
+			const float x1 = math::max(cmd->clip_rect.x, 0.0f);
+			const float y1 = math::max(cmd->clip_rect.y, 0.0f);
+			const float x2 = math::min(cmd->clip_rect.x + cmd->clip_rect.w, canvasSize.x);
+			const float y2 = math::min(cmd->clip_rect.y + cmd->clip_rect.h, canvasSize.y);
+			if (x2 <= x1 || y2 <= y1)
+				continue;
+			const Rect2i clipRect = Rect2i(Point2i(x1 * scale.x, (canvasSize.y - y2) * scale.y),
+					vec2i((x2 - x1) * scale.x, (y2 - y1) * scale.y));
+			const TextureHandle texture = (TextureHandle)cmd->texture.id;
+
+			if (drawBatches.size() > 0)
+			{
+				imGui::DrawBatch& last = drawBatches.back();
+				const bool contiguous = last.indexOffset + last.elementCount * sizeof(nk_draw_index) == cmdOffset;
+				if (contiguous && texture == last.texture && clipRect.vec == last.clipRect.vec)
+				{
+					last.elementCount += cmd->elem_count;
+					continue;
+				}
+			}
+
+			imGui::DrawBatch batch;
+			batch.texture = texture;
+			batch.clipRect = clipRect;
+			batch.indexOffset = cmdOffset;
+			batch.elementCount = cmd->elem_count;
+			drawBatches.push_back(batch);
+		}
+	}
+
+	void bindNativeProgram(const mat4& projMatrix, float depthScale)
+	{
+		using namespace Graphics;
+		const Resources& resources = this->resources;
+		NativeContext& native = layer->native;
+
+		bindProgram(resources.nativeShaderInfo.program);
+		setUniform(resources.nativeShaderInfo.mvpUniform, projMatrix);
+		setUniform(resources.nativeShaderInfo.texUniform, TextureChannel(0));
+		setUniform(resources.nativeDepthScaleUniform, depthScale);
+		setUniform(resources.nativePosScaleUniform, native.vertexFormat == IMGuiVertexFormat::Compact ? 1.0f / imGui::COMPACT_SUBPIXEL_COUNT : 1.0f);
+		bind2dTexture(TextureChannel(0), resources.fontTexture);
+		updateVertexAttributeBindings(resources.nativeShaderInfo, native.attributeBindings, native.vertexStream.get(), native.vertexFormat, 
+				&native.boundVertexBuffer, &native.boundVertexGeneration, &native.boundVertexFormat);
+		bindAttributes(native.attributeBindings);
+		bindIndexBuffer(getStreamBufferHandle(native.indexStream.get()));
+	}
+
+	void bindCircleProgram(const mat4& projMatrix, float depthScale, bool opaquePass)
+	{
+		using namespace Graphics;
+		const CircleShaderInfo& circleShaderInfo = resources.circleShaderInfo;
+
+		bindProgram(circleShaderInfo.program);
+		setUniform(circleShaderInfo.mvpUniform, projMatrix);
+		setUniform(circleShaderInfo.depthScaleUniform, depthScale);
+		setUniform(circleShaderInfo.opaquePassUniform, opaquePass ? 1 : 0);
+	}
+
+	// Native program has to be bound, index offset in bytes
+	void drawNativeTriangles(uint chunk, uint indexOffset, uint indexCount)
+	{
+		using namespace Graphics;
+		NativeContext& native = layer->native;
+
+		const uint baseVertex = native.vertexOffsets[chunk] / native.vertexSize;
+		setUniform(resources.nativeOrderOffsetUniform, (int)nativeVertexOrder(chunk, 0) - (int)baseVertex);
+		drawIndexed(PrimitiveType::Triangles, indexCount / 3, IndexType::UInt32, indexOffset, baseVertex);
+	}
+
+	// Chunk 0 draws have to be issued first, so stream buffers are free to grow
+	void uploadNativeChunk1()
+	{
+		using namespace Graphics;
+		NativeContext& native = layer->native;
+
+		fenceStreamBufferData(native.vertexStream);
+		fenceStreamBufferData(native.indexStream);
+
+		const uint vertexDataSize = native.vertexCount * native.vertexSize;
+		memcpy(reserveStreamBufferData(native.vertexStream, vertexDataSize, native.vertexSize), native.spillVertices.data(), vertexDataSize);
+		native.vertexOffsets[1] = commitStreamBufferData(native.vertexStream, vertexDataSize);
+
+		// Blended indices followed by opaque ones front to back
+		const uint indexDataSize = native.indexCount * sizeof(nk_draw_index);
+		const uint opaqueIndexDataSize = native.opaqueIndexCount * sizeof(nk_draw_index);
+		nk_draw_index* const indices = (nk_draw_index*)reserveStreamBufferData(native.indexStream, 
+				indexDataSize + opaqueIndexDataSize, sizeof(nk_draw_index)).get();
+		memcpy(indices, native.spillIndices.data(), indexDataSize);
+		imGui::reverseTriangles(indices + native.indexCount, native.spillOpaqueIndices.data(), native.opaqueIndexCount);
+		native.indexOffsets[1] = commitStreamBufferData(native.indexStream, indexDataSize + opaqueIndexDataSize);
+		native.opaqueIndexOffsets[1] = native.indexOffsets[1] + indexDataSize;
+		native.vertexCommitSizes[1] = vertexDataSize;
+		native.indexCommitSizes[1] = indexDataSize + opaqueIndexDataSize;
+	}
+
+	// Native primitives go beneath nuklear geometry, returns number of draw calls
+	//	Opaque triangles and circle centers are drawn first, front to back with depth writes, 
+	//	then blended batches in call order skip whatever is hidden beneath them
+	//	Clean layers draw the chunks committed when they were last drawn, without uploading anything
+	uint renderNative(const mat4& projMatrix)
+	{
+		using namespace Graphics;
+		NativeContext& native = layer->native;
+		const auto& circles = layer->circles;
+		const bool retained = !layer->dirty;
+
+		if (!retained)
+		{
+			tessellateNative();
+			commitNativeChunk0();
+			const uint vertexCount = nativeVertexOrder(native.chunk, native.vertexCount);
+			PROFILER_COUNTER_ADD("IMGuiNativeVertices", vertexCount);
+			PROFILER_COUNTER_ADD("IMGuiNativeVertexBytes", vertexCount * native.vertexSize);
+		}
+		const bool spilled = native.chunk == 1;
+		const uint vertexCount = nativeVertexOrder(native.chunk, native.vertexCount);
+		PROFILER_COUNTER_ADD("IMGuiNativeOpaqueIndices", native.chunk0OpaqueIndexCount + (spilled ? native.opaqueIndexCount : 0));
+		const bool circlesRetained = circles.size() > 0 && uploadCircles();
+		const float depthScale = imGui::orderDepthScale(vertexCount);
+
+		setClipMode(ClipMode::Disabled);
+		setDepthTestMode(DepthTestMode::Enabled);
+
+		uint drawCallCount = 0;
+		setBlendMode(BlendMode::Disabled);
+		setDepthWriteMode(DepthWriteMode::Enabled);
+		if (native.chunk0OpaqueIndexCount > 0)
+		{
+			bindNativeProgram(projMatrix, depthScale);
+			drawNativeTriangles(0, native.opaqueIndexOffsets[0], native.chunk0OpaqueIndexCount);
+			++drawCallCount;
+		}
+		if (layer->opaqueCircleCount > 0)
+		{
+			bindCircleProgram(projMatrix, depthScale, true);
+			drawCircles(0, circles.size());
+			++drawCallCount;
+		}
+
+		setBlendMode(BlendMode::AlphaBlend);
+		setDepthWriteMode(DepthWriteMode::Disabled);
+
+		// Spilled opaque geometry is drawn once chunk 1 is uploaded, still correct but hides less
+		bool chunk1Uploaded = false;
+		auto beginChunk1 = [&]()
+		{
+			if (!retained)
+				uploadNativeChunk1();
+			chunk1Uploaded = true;
+			if (native.opaqueIndexCount == 0)
+				return;
+
+			setBlendMode(BlendMode::Disabled);
+			setDepthWriteMode(DepthWriteMode::Enabled);
+			bindNativeProgram(projMatrix, depthScale);
+			drawNativeTriangles(1, native.opaqueIndexOffsets[1], native.opaqueIndexCount);
+			setBlendMode(BlendMode::AlphaBlend);
+			setDepthWriteMode(DepthWriteMode::Disabled);
+			++drawCallCount;
+		};
+
+		imGui::NativeBatchType boundType = imGui::NativeBatchType::Circles;
+		bool programBound = false;
+		for (const auto& batch : native.batches)
+		{
+			if (batch.type == imGui::NativeBatchType::Triangles)
+			{
+				if (batch.chunk == 1 && !chunk1Uploaded)
+				{
+					beginChunk1();
+					programBound = false;
+				}
+
+				if (!programBound || boundType != batch.type)
+					bindNativeProgram(projMatrix, depthScale);
+				drawNativeTriangles(batch.chunk, native.indexOffsets[batch.chunk] + batch.first * sizeof(nk_draw_index), batch.count);
+			}
+			else
+			{
+				if (!programBound || boundType != batch.type)
+					bindCircleProgram(projMatrix, depthScale, false);
+				drawCircles(batch.first, batch.count);
+			}
+			boundType = batch.type;
+			programBound = true;
+			++drawCallCount;
+		}
+		if (spilled && !chunk1Uploaded)
+			beginChunk1();
+
+		setDepthWriteMode(DepthWriteMode::Enabled);
+		setDepthTestMode(DepthTestMode::Disabled);
+
+		if (retained)
+		{
+			for (uint chunk = 0; chunk < 2; ++chunk)
+			{
+				fenceStreamBufferRange(native.vertexStream, native.vertexOffsets[chunk], native.vertexCommitSizes[chunk]);
+				fenceStreamBufferRange(native.indexStream, native.indexOffsets[chunk], native.indexCommitSizes[chunk]);
+			}
+		}
+		else
+		{
+			fenceStreamBufferData(native.vertexStream);
+			fenceStreamBufferData(native.indexStream);
+			endNative();
+		}
+		if (circles.size() > 0)
+			fenceCircles(circlesRetained);
+
+		return drawCallCount;
+	}
+
+	void endNative()
+	{
+		NativeContext& native = layer->native;
+
+		// Reserve enough for whole frame next time
+		if (native.chunk == 1)
+		{
+			native.vertexReservationSize = math::max(native.vertexReservationSize * 2, native.chunk0VertexDataSize + native.vertexCount * native.vertexSize);
+			native.indexReservationSize = math::max(native.indexReservationSize * 2, native.chunk0IndexDataSize + native.indexCount * (uint)sizeof(nk_draw_index));
+			LOG("Growing native IMGui reservations to " << native.vertexReservationSize << " vertex bytes, " 
+					<< native.indexReservationSize << " index bytes");
+		}
+	}
+
+	// Appends native draws to capture in the order they are rendered, indices rebased to capture vertices
+	void captureNative(IMGuiCapture* capture)
+	{
+		NativeContext& native = layer->native;
+		const auto& circles = layer->circles;
+
+		if (layer->dirty)
+		{
+			tessellateNative();
+			commitNativeChunk0();
+		}
+		const bool spilled = native.chunk == 1;
+
+		const uint chunk0VertexCount = native.chunk0VertexDataSize / native.vertexSize;
+		const uint chunk1VertexCount = spilled ? native.vertexCount : 0;
+		const uint chunkBaseVertices[2] = { (uint)capture->vertices.size(), (uint)capture->vertices.size() + chunk0VertexCount };
+		const nk_draw_index* const chunkIndices[2] = { native.chunk0Indices, native.spillIndices.data() };
+		capture->vertices.resize(chunkBaseVertices[1] + chunk1VertexCount);
+		imGui::decodeVertices(capture->vertices.data() + chunkBaseVertices[0], native.chunk0Vertices, chunk0VertexCount, native.vertexFormat);
+		imGui::decodeVertices(capture->vertices.data() + chunkBaseVertices[1], native.spillVertices.data(), chunk1VertexCount, native.vertexFormat);
+		capture->vertexDataSize += (chunk0VertexCount + chunk1VertexCount) * native.vertexSize;
+
+		const uint circleBase = capture->circles.size();
+		capture->circles.resize(circleBase + circles.size());
+		memcpy(capture->circles.data() + circleBase, circles.data(), circles.size() * sizeof(imGui::CircleInstance));
+
+		auto addTriangles = [&](uint chunk, const nk_draw_index* indices, uint indexCount, bool opaque)
+		{
+			IMGuiCapture::Command command;
+			command.type = IMGuiCapture::CommandType::Triangles;
+			command.texture = (uint)resources.fontTexture;
+			command.clipped = false;
+			command.opaque = opaque;
+			command.first = capture->indices.size();
+			command.count = indexCount;
+			for (uint i = 0; i < indexCount; ++i)
+				capture->indices.push_back(indices[i] + chunkBaseVertices[chunk]);
+			capture->commands.push_back(command);
+		};
+		auto addCircles = [&](uint first, uint count, bool opaque)
+		{
+			IMGuiCapture::Command command;
+			command.type = IMGuiCapture::CommandType::Circles;
+			command.texture = 0;
+			command.clipped = false;
+			command.opaque = opaque;
+			command.first = circleBase + first;
+			command.count = count;
+			capture->commands.push_back(command);
+		};
+
+		if (native.chunk0OpaqueIndexCount > 0)
+			addTriangles(0, native.chunk0Indices + native.opaqueIndexOffsets[0] / sizeof(nk_draw_index), native.chunk0OpaqueIndexCount, true);
+		if (layer->opaqueCircleCount > 0)
+			addCircles(0, circles.size(), true);
+
+		vector<nk_draw_index> chunk1OpaqueIndices;
+		bool chunk1Begun = false;
+		auto beginChunk1 = [&]()
+		{
+			chunk1Begun = true;
+			if (native.opaqueIndexCount == 0)
+				return;
+
+			chunk1OpaqueIndices.resize(native.opaqueIndexCount);
+			imGui::reverseTriangles(chunk1OpaqueIndices.data(), native.spillOpaqueIndices.data(), native.opaqueIndexCount);
+			addTriangles(1, chunk1OpaqueIndices.data(), native.opaqueIndexCount, true);
+		};
+
+		for (const auto& batch : native.batches)
+		{
+			if (batch.type == imGui::NativeBatchType::Triangles)
+			{
+				if (batch.chunk == 1 && !chunk1Begun)
+					beginChunk1();
+				addTriangles(batch.chunk, chunkIndices[batch.chunk] + batch.first, batch.count, false);
+			}
+			else
+			{
+				addCircles(batch.first, batch.count, false);
+			}
+		}
+		if (spilled && !chunk1Begun)
+			beginChunk1();
+
+		if (layer->dirty)
+			endNative();
+	}
+
+	// Draws nuklear geometry of current layer, returns number of draw calls
+	//	Geometry is only converted again when the layer's commands or the window size changed
+	uint renderNuklear(const mat4& projMatrix, const vec2i& windowSize, const vec2& scale, uint* stateChangeCount)
+	{
+		using namespace Graphics;
+		Context& ctx = layer->context;
+		if (!layer->hasNuklearGeometry)
+		{
+			ctx.hasRetainedGeometry = false;
+			return 0;
+		}
+
+		const ShaderInfo& shaderInfo = resources.shaderInfo;
+		const vec2& canvasSize = lastCanvasSize;
+
+		// Hash everything that affects converted geometry and draw batches
+		uint64 hash = hashMemory(&windowSize, sizeof(windowSize));
+		hash = hashMemory(&canvasSize, sizeof(canvasSize), hash);
+		hash = hashMemory(&layer->commandHash, sizeof(layer->commandHash), hash);
+		const bool retained = ctx.hasRetainedGeometry && hash == ctx.geometryHash;
+
+		// Write data to buffers
+		if (!retained)
+		{
+			PROFILER_SCOPE("IMGuiConvert", &kProfilerCategoryIMGui);
+
+			// Convert straight into mapped stream buffers, grow and convert again if reserved space was too small
+			createStreamBufferOnce(&ctx.vertexStream, BufferTarget::Vertex, ctx.vertexReservationSize);
+			createStreamBufferOnce(&ctx.indexStream, BufferTarget::Index, ctx.indexReservationSize);
+			while (true)
+			{
+				const not_null<void*> vertices = reserveStreamBufferData(ctx.vertexStream, ctx.vertexReservationSize, sizeof(imGui::NkVertex));
+				const not_null<void*> indices = reserveStreamBufferData(ctx.indexStream, ctx.indexReservationSize, sizeof(nk_draw_index));
+				if (convertNuklear(vertices, indices))
+				{
+					// Only upload what was actually written
+					ctx.vertexOffset = commitStreamBufferData(ctx.vertexStream, ctx.vertexDataSize);
+					ctx.indexOffset = commitStreamBufferData(ctx.indexStream, ctx.indexDataSize);
+					break;
+				}
+
+				commitStreamBufferData(ctx.vertexStream, 0);
+				commitStreamBufferData(ctx.indexStream, 0);
+			}
+
+			buildDrawBatches(scale);
+
+			// Batches only change with the geometry, as does its place in the stream buffers
+			//	Projection follows the canvas size, and stream buffers are only replaced when converting
+			CommandBuffer* const drawCommands = ctx.drawCommands.get();
+			resetCommandBuffer(drawCommands);
+			recordSetClipMode(drawCommands, ClipMode::Enabled);
+			recordBindProgram(drawCommands, shaderInfo.program);
+			recordSetUniform(drawCommands, shaderInfo.mvpUniform, projMatrix);
+			recordSetUniform(drawCommands, shaderInfo.texUniform, TextureChannel(0));
+			recordBindAttributes(drawCommands, ctx.attributeBindings);
+			recordBindIndexBuffer(drawCommands, getStreamBufferHandle(ctx.indexStream.get()));
+			ctx.drawStateChangeCount = 0;
+			const uint baseVertex = ctx.vertexOffset / sizeof(imGui::NkVertex);
+			const imGui::DrawBatch* bound = nullptr;
+			for (const auto& batch : ctx.drawBatches)
+			{
+				if (!bound || batch.texture != bound->texture)
+				{
+					recordBind2dTexture(drawCommands, TextureChannel(0), batch.texture);
+					++ctx.drawStateChangeCount;
+				}
+				if (!bound || batch.clipRect.vec != bound->clipRect.vec)
+				{
+					recordSetClipArea(drawCommands, batch.clipRect);
+					++ctx.drawStateChangeCount;
+				}
+				recordDrawIndexed(drawCommands, PrimitiveType::Triangles, batch.elementCount / 3, IndexType::UInt32, 
+						batch.indexOffset, baseVertex);
+				bound = &batch;
+			}
+
+			ctx.hasRetainedGeometry = true;
+			ctx.geometryHash = hash;
+		}
+
+		// Draw, attribute bindings are stored before replay binds them
+		updateVertexAttributeBindings(shaderInfo, ctx.attributeBindings, ctx.vertexStream.get(), IMGuiVertexFormat::Float, 
+				&ctx.boundVertexBuffer, &ctx.boundVertexGeneration, &ctx.boundVertexFormat);
+		executeCommandBuffer(ctx.drawCommands.get());
+		*stateChangeCount += ctx.drawStateChangeCount;
+
+		if (retained)
+		{
+			fenceStreamBufferRange(ctx.vertexStream, ctx.vertexOffset, ctx.vertexDataSize);
+			fenceStreamBufferRange(ctx.indexStream, ctx.indexOffset, ctx.indexDataSize);
+		}
+		else
+		{
+			fenceStreamBufferData(ctx.vertexStream);
+			fenceStreamBufferData(ctx.indexStream);
+		}
+
+		return ctx.drawBatches.size();
+	}
+
+	// Appends nuklear draws of current layer to capture, converted every time
+	void captureNuklear(IMGuiCapture* capture, const vec2& scale)
+	{
+		Context& ctx = layer->context;
+
+		{
+			PROFILER_SCOPE("IMGuiConvert", &kProfilerCategoryIMGui);
+
+			while (true)
+			{
+				ctx.captureVertices.resize(ctx.vertexReservationSize / sizeof(imGui::NkVertex));
+				ctx.captureIndices.resize(ctx.indexReservationSize / sizeof(nk_draw_index));
+				if (convertNuklear(ctx.captureVertices.data(), ctx.captureIndices.data()))
+					break;
+			}
+
+			ctx.indexOffset = 0;
+			buildDrawBatches(scale);
+		}
+
+		// Indices are rebased onto vertices captured before nuklear's
+		const uint baseVertex = capture->vertices.size();
+		const uint vertexCount = ctx.vertexDataSize / sizeof(imGui::NkVertex);
+		capture->vertices.resize(baseVertex + vertexCount);
+		memcpy(capture->vertices.data() + baseVertex, ctx.captureVertices.data(), ctx.vertexDataSize);
+		capture->vertexDataSize += ctx.vertexDataSize;
+
+		for (const auto& batch : ctx.drawBatches)
+		{
+			IMGuiCapture::Command command;
+			command.type = IMGuiCapture::CommandType::Triangles;
+			command.texture = (uint)batch.texture;
+			command.clipRect = batch.clipRect;
+			command.clipped = true;
+			command.opaque = false;
+			command.first = capture->indices.size();
+			command.count = batch.elementCount;
+			const nk_draw_index* const indices = &ctx.captureIndices[batch.indexOffset / sizeof(nk_draw_index)];
+			for (uint i = 0; i < batch.elementCount; ++i)
+				capture->indices.push_back(indices[i] + baseVertex);
+			capture->commands.push_back(command);
+		}
+	}
+
+	// Nuklear backend layers draw their batched circles in one go
+	void captureCircles(IMGuiCapture* capture)
+	{
+		const auto& circles = layer->circles;
+		const uint circleBase = capture->circles.size();
+		capture->circles.resize(circleBase + circles.size());
+		memcpy(capture->circles.data() + circleBase, circles.data(), circles.size() * sizeof(imGui::CircleInstance));
+
+		IMGuiCapture::Command command;
+		command.type = IMGuiCapture::CommandType::Circles;
+		command.texture = 0;
+		command.clipped = false;
+		command.first = circleBase;
+		command.count = circles.size();
+		if (layer->opaqueCircleCount > 0)
+		{
+			command.opaque = true;
+			capture->commands.push_back(command);
+		}
+		command.opaque = false;
+		capture->commands.push_back(command);
+	}
+
+	void addCircle(const imGui::CircleInstance& circle)
+	{
+		Layer& layer = recordingLayer();
+		layer.circles.push_back(circle);
+		if (circle.color[3] == 255)
+			++layer.opaqueCircleCount;
+	}
+
+	static void clearCircles(Layer* layer)
+	{
+		layer->circles.clear();
+		layer->opaqueCircleCount = 0;
+	}
+
+	IMGuiOutput output;
+	Resources resources;
+	vector<unique_ptr<Layer>> layers;
+	// Layers begun and not yet ended, innermost last
+	vector<Layer*> layerStack;
+	// Layer being recorded, or drawn while rendering
+	Layer* layer = nullptr;
+	vector<Layer*> drawOrder;
+	bool frameOpen = false;
+	IMGuiBackend backend = IMGuiBackend::Nuklear;
+	// Backend in use for current frame, changes take effect on next beginFrame
+	IMGuiBackend frameBackend = IMGuiBackend::Nuklear;
+	IMGuiVertexFormat vertexFormat = IMGuiVertexFormat::Float;
+	// Canvas to window scale of last render, used for picking circle segment counts
+	vec2 pixelScale = vec2(1.0f, 1.0f);
+	WorkerPool* workers = nullptr;
+
+	// Keyed by hash of font, size and text
+	std::unordered_map<uint64, imGui::GlyphRun> glyphRuns;
+	std::deque<imGui::GlyphRun> uncachedGlyphRuns;
+	uint64 frameNumber = 0;
+	imGui::InputState input;
+	vec2 lastCanvasSize;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+IMGui::IMGui(IMGuiOutput output)
+	: m_impl(make_unique<IMGuiImpl>(output))
+{
+
+
+}
+
+IMGui::~IMGui()
+{
+
+
+}
+
+void IMGui::beginInput()
+{
+	imGui::InputState& input = m_impl->input;
+	input.mousePositionAtBegin = input.mousePosition;
+	input.mouseScroll = 0;
+	for (bool& clicked : input.buttonClicked)
+		clicked = false;
+
+	for (auto& layer : m_impl->layers)
+		nk_input_begin(&layer->context.nk);
+}
+
+void IMGui::processEvent(const SDL_Event& event)
+{
+	imGui::InputState& input = m_impl->input;
+	const auto& layers = m_impl->layers;
+
+	switch (event.type)
+	{
+		case SDL_MOUSEMOTION:
+		{
+			input.mousePosition = vec2(event.motion.x, event.motion.y);
+			for (auto& layer : layers)
+				nk_input_motion(&layer->context.nk, event.motion.x, event.motion.y);
+			break;
+		}
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+		{
+			MouseButton button;
+			if (!imGui::toMouseButton(event.button.button, &button))
+				break;
+
+			const bool down = (event.type == SDL_MOUSEBUTTONDOWN);
+			const vec2 position = vec2(event.button.x, event.button.y);
+			input.mousePosition = position;
+			input.buttonDown[(int)button] = down;
+			if (down)
+			{
+				input.buttonClicked[(int)button] = true;
+				input.clickPosition[(int)button] = position;
+			}
+			for (auto& layer : layers)
+				nk_input_button(&layer->context.nk, imGui::toNkButton(button), event.button.x, event.button.y, down);
+			break;
+		}
+		case SDL_MOUSEWHEEL:
+		{
+			input.mouseScroll += event.wheel.y;
+			break;
+		}
+		default:
+		{
+		}
+	}
+}
+
+void IMGui::endInput()
+{
+	imGui::InputState& input = m_impl->input;
+	input.mouseDelta = input.mousePosition - input.mousePositionAtBegin;
+
+	for (auto& layer : m_impl->layers)
+		nk_input_end(&layer->context.nk);
+}
+
+vec2 IMGui::getMousePosition() const
+{
+	return m_impl->input.mousePosition;
+}
+
+vec2 IMGui::getMouseDelta() const
+{
+	return m_impl->input.mouseDelta;
+}
+
+float IMGui::getMouseScroll() const
+{
+	return m_impl->input.mouseScroll;
+}
+
+bool IMGui::isMouseDown(MouseButton button) const
+{
+	return m_impl->input.buttonDown[(int)button];
+}
+
+bool IMGui::isMouseHovering(const Rect2& rect) const
+{
+	return rect.contains(m_impl->input.mousePosition);
+}
+
+bool IMGui::isMouseClicked(MouseButton button, const Rect2& rect) const
+{
+	const imGui::InputState& input = m_impl->input;
+	return input.buttonClicked[(int)button] && rect.contains(input.clickPosition[(int)button]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void IMGui::beginFrame(const vec2& canvasSize)
 {
 	PROFILER_SCOPE("IMGuiBegin", &kProfilerCategoryIMGui);
+	FATAL_ASSERT_DESC(!m_impl->frameOpen, "IMGui frame already begun");
 
-	IMGuiImpl::Context& ctx = m_impl->context;
-	nk_begin(&ctx.nk, "imgui", imGui::toNkRect(Rect2(Point2(0, 0), canvasSize)), NK_WINDOW_NO_SCROLLBAR);
-	m_impl->canvas = nk_window_get_canvas(&ctx.nk);
 	m_impl->lastCanvasSize = canvasSize;
+	m_impl->evictGlyphRuns();
+
+	m_impl->frameBackend = m_impl->backend;
+	m_impl->frameOpen = true;
+	m_impl->beginLayer(imGui::DEFAULT_LAYER_NAME, 0);
 }
 	
 void IMGui::endFrame()
 {
 	PROFILER_SCOPE("IMGuiEnd", &kProfilerCategoryIMGui);
+	FATAL_ASSERT_DESC(m_impl->layerStack.size() == 1, "Layers have to be ended before endFrame");
+
+	m_impl->endLayer();
+	m_impl->frameOpen = false;
+}
+
+void IMGui::beginLayer(string_view name, int zOrder)
+{
+	m_impl->beginLayer(name, zOrder);
+}
+
+void IMGui::endLayer()
+{
+	FATAL_ASSERT_DESC(m_impl->layerStack.size() > 1, "Default layer is ended by endFrame");
+	m_impl->endLayer();
+}
+
+void IMGui::clearLayer(string_view name)
+{
+	IMGuiImpl::Layer* layer = m_impl->findLayer(name);
+	if (!layer)
+		return;
+	FATAL_ASSERT_DESC(!layer->canvas, "Layer can not be cleared while begun");
+	layer->visible = false;
+}
+
+void IMGui::setPrimitiveBackend(IMGuiBackend backend)
+{
+	m_impl->backend = backend;
+}
+
+void IMGui::setVertexFormat(IMGuiVertexFormat format)
+{
+	m_impl->vertexFormat = format;
+}
 
-	IMGuiImpl::Context& ctx = m_impl->context;
-	nk_end(&ctx.nk);
-	m_impl->canvas = nullptr;
+void IMGui::setTessellationWorkers(WorkerPool* workers)
+{
+	m_impl->workers = workers;
 }
 
 void IMGui::filledRect(const Rect2& rect, const Color32& color)
 {
-	nk_command_buffer* canvas = m_impl->canvas;
-	FATAL_ASSERT(canvas);
+	IMGuiImpl::Layer& layer = m_impl->recordingLayer();
+	if (layer.backend == IMGuiBackend::Native)
+	{
+		m_impl->nativeRect(vec2(rect.x1, rect.y1), vec2(rect.x2, rect.y2), color.bytes());
+		return;
+	}
+
+	nk_command_buffer* canvas = layer.canvas;
 	const auto c = color.bytes();
 	nk_fill_rect(canvas, imGui::toNkRect(rect), 
 			0, nk_rgba(c.x, c.y, c.z, c.w));
@@ -270,27 +2558,60 @@ void IMGui::filledRect(const Rect2& rect, const Color32& color)
 
 void IMGui::filledCircle(const Rect2& rect, const Color32& color)
 {
-	nk_command_buffer* canvas = m_impl->canvas;
-	FATAL_ASSERT(canvas);
+	IMGuiImpl::Layer& layer = m_impl->recordingLayer();
+	if (layer.backend == IMGuiBackend::Native)
+	{
+		const vec2 center = vec2(rect.x + rect.width() * 0.5f, rect.y + rect.height() * 0.5f);
+		m_impl->nativeFilledCircle(center, rect.width() * 0.5f, color.bytes());
+		return;
+	}
+
+	nk_command_buffer* canvas = layer.canvas;
 	auto c = color.bytes();
 	nk_fill_circle(canvas, imGui::toNkRect(rect), 
 			nk_rgba(c.x, c.y, c.z, c.w));
 }
 
+void IMGui::filledCircleBatched(const vec2& center, float radius, const Color32& color)
+{
+	IMGuiImpl::Layer& layer = m_impl->recordingLayer();
+	const auto c = color.bytes();
+	// Native backend replaces order with its place among native vertices
+	const imGui::CircleInstance circle = { { center.x, center.y }, radius, (float)layer.circles.size(), { c.x, c.y, c.z, c.w } };
+	if (layer.backend == IMGuiBackend::Native)
+		m_impl->addNativeCircle(circle);
+	else
+		m_impl->addCircle(circle);
+}
+
 void IMGui::strokedCircle(const Rect2& rect, float lineWidth, const Color32& color)
 {
-	nk_command_buffer* canvas = m_impl->canvas;
-	FATAL_ASSERT(canvas);
+	IMGuiImpl::Layer& layer = m_impl->recordingLayer();
+	if (layer.backend == IMGuiBackend::Native)
+	{
+		const vec2 center = vec2(rect.x + rect.width() * 0.5f, rect.y + rect.height() * 0.5f);
+		m_impl->nativeStrokedCircle(center, rect.width() * 0.5f, lineWidth, color.bytes());
+		return;
+	}
+
+	nk_command_buffer* canvas = layer.canvas;
 	const auto c = color.bytes();
 	nk_stroke_circle(canvas, imGui::toNkRect(rect), 
 			lineWidth, nk_rgba(c.x, c.y, c.z, c.w));
 }
 
-void IMGui::text(const Rect2& rect, const string& text, const Color32& color)
+void IMGui::text(const Rect2& rect, string_view text, const Color32& color)
 {
-	nk_command_buffer* canvas = m_impl->canvas;
+	IMGuiImpl::Layer& layer = m_impl->recordingLayer();
+	if (layer.backend == IMGuiBackend::Native)
+	{
+		m_impl->nativeText(rect, text, color.bytes());
+		return;
+	}
+
+	nk_command_buffer* canvas = layer.canvas;
 	const auto c = color.bytes();
-	const auto style = &m_impl->context.nk.style;
+	const auto style = &layer.context.nk.style;
 
     struct nk_text textInfo;
     textInfo.padding.x = style->text.padding.x;
@@ -298,102 +2619,119 @@ void IMGui::text(const Rect2& rect, const string& text, const Color32& color)
     textInfo.background = nk_rgba(0, 0, 0, 0);
     textInfo.text = nk_rgba(c.x, c.y, c.z, c.w);
 
-	nk_widget_text(canvas, imGui::toNkRect(rect), text.c_str(), 
-			text.length(), &textInfo, NK_TEXT_CENTERED, style->font);
+	nk_widget_text(canvas, imGui::toNkRect(rect), text.data(), 
+			(int)text.length(), &textInfo, NK_TEXT_CENTERED, style->font);
 
 	//nk_draw_text(canvas, imGui::toNkRect(rect), text.c_str(), 
 	//	text.length(), style->font, nk_rgba(0, 0, 0, 0), nk_rgba(c.x, c.y, c.z, c.w));
 }
 
+float IMGui::textWidth(string_view text) const
+{
+	const nk_user_font* font = m_impl->resources.font;
+	return m_impl->getGlyphRun(font, text)->width;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void IMGui::render(not_null<const Graphics::Window*> window)
 {
 	PROFILER_SCOPE("IMGuiRender", &kProfilerCategoryIMGui);
+	GPU_PROFILER_SCOPE("IMGuiRender", &kProfilerCategoryIMGui);
+	FATAL_ASSERT_DESC(m_impl->output == IMGuiOutput::Graphics, "Capturing IMGui can not render");
+	FATAL_ASSERT_DESC(m_impl->layerStack.size() == 0, "IMGui can only be rendered after endFrame");
 
 	using namespace Graphics;	
 
-	// TODO: Make const? Move convert to other function render/dispatch?
-	IMGuiImpl::Context& ctx = m_impl->context;
 	const vec2& canvasSize = m_impl->lastCanvasSize;
 
 	const mat4 projMatrix = math::ortho(0.0f, canvasSize.x, canvasSize.y, 0.0f);
 
 	const vec2i windowSize = Graphics::getWindowSize(window);
 	const vec2 scale = vec2(windowSize.x / canvasSize.x, windowSize.y / canvasSize.y);
+	m_impl->pixelScale = scale;
 
 	// Set up frame
 	setBlendMode(BlendMode::AlphaBlend);
 	setDepthTestMode(DepthTestMode::Disabled);
 	setCullMode(CullMode::Disabled);
-	setClipMode(ClipMode::Enabled);
- 	
-	bindProgram(ctx.shaderInfo.program);
-	setUniform(ctx.shaderInfo.mvpUniform, projMatrix);
-	setUniform(ctx.shaderInfo.texUniform, TextureChannel(0));
-
-	// Write data to buffers
-	{
-		const auto vBufferSize = imGui::MAX_VERTEX_COUNT * sizeof(imGui::NkVertex);
-		const auto iBufferSize = imGui::MAX_INDEX_COUNT * sizeof(uint16);	
-		const not_null<imGui::NkVertex*> vertices = (imGui::NkVertex*)createAndMapVertexBufferData(ctx.vertexBuffer, vBufferSize);
-		const not_null<uint16*> indices = (uint16*)createAndMapIndexBufferData(ctx.indexBuffer, iBufferSize);
-	
-		/* fill convert configuration */
-		static const nk_draw_vertex_layout_element vertex_layout[] = {
-			{NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(imGui::NkVertex, pos)},
-			{NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(imGui::NkVertex, uv)},
-			{NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(imGui::NkVertex, color)},
-			{NK_VERTEX_LAYOUT_END}};
 
-		nk_convert_config config;
-		NK_MEMSET(&config, 0, sizeof(config));
-		config.vertex_layout = vertex_layout;
-		config.vertex_size = sizeof(imGui::NkVertex);
-		config.vertex_alignment = NK_ALIGNOF(imGui::NkVertex);
-		config.null = ctx.nkNullTexture;
-		config.circle_segment_count = 32;
-		config.curve_segment_count = 32;
-		config.arc_segment_count = 32;
-		config.global_alpha = 1.0f;
-		config.shape_AA = NK_ANTI_ALIASING_OFF;
-		config.line_AA = NK_ANTI_ALIASING_OFF;
+	uint drawCallCount = 0;
+	uint stateChangeCount = 0;
+	uint retainedLayerCount = 0;
+	bool depthWritten = false;
+	for (IMGuiImpl::Layer* layer : m_impl->sortLayers())
+	{
+		m_impl->layer = layer;
+		if (!layer->dirty)
+			++retainedLayerCount;
 
-		/* setup buffers to load vertices and elements */
-		nk_buffer vbuf, ibuf;
-		nk_buffer_init_fixed(&vbuf, vertices, (nk_size)vBufferSize);
-		nk_buffer_init_fixed(&ibuf, indices, (nk_size)iBufferSize);
-		nk_convert(&ctx.nk, &ctx.nkCommands, &vbuf, &ibuf, &config);
-		
-		unmapVertexBufferData();
-		unmapIndexBufferData();
-	}
+		// Depth orders primitives within a layer, so it is cleared before each layer that uses it
+		const bool usesDepth = layer->backend == IMGuiBackend::Native || layer->circles.size() > 0;
+		if (usesDepth && depthWritten)
+		{
+			setClipMode(ClipMode::Disabled);
+			clearDepthBuffer();
+		}
+		depthWritten = depthWritten || usesDepth;
 
-	// Draw
-	{
-		bindAttributes(ctx.attributeBindings);
+		// Batched circles and native primitives go beneath nuklear geometry of their layer
+		if (layer->backend == IMGuiBackend::Native)
+		{
+			GPU_PROFILER_SCOPE("IMGuiNative", &kProfilerCategoryIMGui);
+			drawCallCount += m_impl->renderNative(projMatrix);
+		}
+		else if (layer->circles.size() > 0)
+		{
+			GPU_PROFILER_SCOPE("IMGuiCircles", &kProfilerCategoryIMGui);
+			setClipMode(ClipMode::Disabled);
+			m_impl->renderCircles(projMatrix);
+		}
 
-		const nk_draw_index* offset = 0;
-		for(const nk_draw_command* cmd = nk__draw_begin(&ctx.nk, &ctx.nkCommands); 
-				cmd != nullptr; 
-				cmd = nk__draw_next(cmd, &ctx.nkCommands, &ctx.nk))
 		{
-			if (!cmd->elem_count) 
-				continue;
-			bind2dTexture(TextureChannel(0), (TextureHandle)cmd->texture.id);
-			const Rect2i clipRect = Rect2i(Point2i(cmd->clip_rect.x * scale.x,
-					(canvasSize.y - (cmd->clip_rect.y + cmd->clip_rect.h)) * scale.y),
-					vec2i(cmd->clip_rect.w * scale.x, cmd->clip_rect.h * scale.y));
-			setClipArea(clipRect);
-			drawIndexed(PrimitiveType::Triangles, cmd->elem_count / 3, IndexType::UInt16, (uint)(size_t)offset);
-			offset += cmd->elem_count;
+			GPU_PROFILER_SCOPE("IMGuiNuklear", &kProfilerCategoryIMGui);
+			drawCallCount += m_impl->renderNuklear(projMatrix, windowSize, scale, &stateChangeCount);
 		}
+		layer->dirty = false;
 	}
+	m_impl->layer = nullptr;
 
-	// Clear command buffers etc
-	nk_clear(&ctx.nk);	
+	PROFILER_COUNTER_ADD("IMGuiDrawCalls", drawCallCount);
+	PROFILER_COUNTER_ADD("IMGuiStateChanges", stateChangeCount);
+	PROFILER_COUNTER_ADD("IMGuiRetainedLayers", retainedLayerCount);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-}
\ No newline at end of file
+void IMGui::capture(not_null<IMGuiCapture*> capture, const vec2i& framebufferSize)
+{
+	PROFILER_SCOPE("IMGuiCapture", &kProfilerCategoryIMGui);
+	FATAL_ASSERT_DESC(m_impl->output == IMGuiOutput::Capture, "Rendering IMGui can not capture");
+	FATAL_ASSERT_DESC(m_impl->layerStack.size() == 0, "IMGui can only be captured after endFrame");
+
+	const vec2& canvasSize = m_impl->lastCanvasSize;
+	const vec2 scale = vec2(framebufferSize.x / canvasSize.x, framebufferSize.y / canvasSize.y);
+	m_impl->pixelScale = scale;
+
+	capture->clear();
+
+	for (IMGuiImpl::Layer* layer : m_impl->sortLayers())
+	{
+		m_impl->layer = layer;
+		capture->layerFirstCommands.push_back(capture->commands.size());
+
+		// Same order as render, batched circles and native primitives first
+		if (layer->backend == IMGuiBackend::Native)
+			m_impl->captureNative(capture);
+		else if (layer->circles.size() > 0)
+			m_impl->captureCircles(capture);
+
+		m_impl->captureNuklear(capture, scale);
+		layer->dirty = false;
+	}
+	m_impl->layer = nullptr;
+
+	PROFILER_COUNTER_ADD("IMGuiDrawCalls", capture->commands.size());
+}
+
+}
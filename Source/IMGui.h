@@ -2,30 +2,167 @@
 
 #include "Core.h"
 
+union SDL_Event;
+
 namespace jcpe
 {
 
 struct IMGuiImpl;
+class WorkerPool;
 namespace Graphics
 {
 	struct Window;
 }
 
+enum class MouseButton
+{
+	Left = 0,
+	Middle,
+	Right,
+	Count
+};
+
+// Backend used for primitives, nuklear is always used for widgets
+enum class IMGuiBackend
+{
+	Nuklear = 0,
+	// Primitives reserve mapped GPU memory as they are recorded, and are tessellated into it at render
+	//	Triangles and batched circles are drawn in call order, beneath nuklear geometry
+	Native
+};
+
+// Vertex layout of native primitives, nuklear geometry is always float
+enum class IMGuiVertexFormat
+{
+	// 20 bytes, float position and uv
+	Float = 0,
+	// 12 bytes, position in 1/8 canvas units within +-4096 and 16 bit normalized uv
+	Compact
+};
+
+// Where rendered frames go
+enum class IMGuiOutput
+{
+	Graphics = 0,
+	// Converted into CPU memory and recorded instead of drawn, needs no graphics context
+	Capture
+};
+
+// Draw list of a captured frame, commands in the order they would have been drawn
+struct IMGuiCapture
+{
+	struct Vertex
+	{
+		vec2 pos;
+		vec2 uv;
+		vec4u8 color;
+	};
+
+	struct Circle
+	{
+		vec2 center;
+		float radius;
+		// Draw order used for depth
+		float order;
+		vec4u8 color;
+	};
+
+	enum class CommandType
+	{
+		Triangles = 0,
+		Circles
+	};
+
+	struct Command
+	{
+		CommandType type;
+		// Nuklear texture id, zero for circles
+		uint texture;
+		// Scissor area in framebuffer pixels with y up, only valid if clipped
+		Rect2i clipRect = Rect2i(0, 0, 0, 0);
+		bool clipped;
+		// Drawn before blended commands with depth writes and no blending, triangles front to back
+		bool opaque;
+		// Range of indices for triangles, of circles for circles
+		uint first;
+		uint count;
+	};
+
+	// Compact native vertices are decoded back to float
+	vector<Vertex> vertices;
+	// Absolute, index vertices directly
+	vector<uint32> indices;
+	vector<Circle> circles;
+	vector<Command> commands;
+	// First command of each layer back to front, depth is cleared before each layer
+	vector<uint> layerFirstCommands;
+	// Bytes of vertex data the frame would have uploaded, in the format it would have been uploaded in
+	uint vertexDataSize = 0;
+
+	void clear()
+	{
+		vertexDataSize = 0;
+		vertices.clear();
+		indices.clear();
+		circles.clear();
+		commands.clear();
+		layerFirstCommands.clear();
+	}
+};
+
 class IMGui
 {
 public:
-	IMGui();
+	IMGui(IMGuiOutput output = IMGuiOutput::Graphics);
 	~IMGui();
 
+	// Input for a frame has to be fed before beginFrame
+	void beginInput();
+	void processEvent(const SDL_Event& event);
+	void endInput();
+
+	vec2 getMousePosition() const;
+	vec2 getMouseDelta() const;
+	float getMouseScroll() const;
+	bool isMouseDown(MouseButton button) const;
+	bool isMouseHovering(const Rect2& rect) const;
+	// True if button was pressed this frame inside rect
+	bool isMouseClicked(MouseButton button, const Rect2& rect) const;
+
+	// Takes effect on next beginFrame
+	void setPrimitiveBackend(IMGuiBackend backend);
+	// Native backend only, takes effect on next beginFrame
+	void setVertexFormat(IMGuiVertexFormat format);
+	// Native primitives are always tessellated at render, on these workers, or inline on the rendering thread if null
+	//	Output is identical either way. Takes effect on next beginFrame
+	void setTessellationWorkers(WorkerPool* workers);
+
+	// Begins and ends the default layer, at z-order 0
 	void beginFrame(const vec2& canvasSize);
 	void endFrame();
 
+	// Primitives go to the innermost begun layer, layers are drawn back to front by z-order
+	//	A layer not begun in a frame keeps its last recording and is drawn without being rebuilt or uploaded
+	//	Each layer can be begun once per frame, and keeps the backend of the frame it was recorded in
+	void beginLayer(string_view name, int zOrder);
+	void endLayer();
+	// Hides layer until it is begun again
+	void clearLayer(string_view name);
+
 	void filledRect(const Rect2& rect, const Color32& color);
 	void filledCircle(const Rect2& rect, const Color32& color);
+	// Instanced and anti-aliased, much cheaper than filledCircle
+	//	Native backend draws it in call order with other primitives, nuklear backend beneath all other geometry of its layer
+	void filledCircleBatched(const vec2& center, float radius, const Color32& color);
 	void strokedCircle(const Rect2& rect, float lineWidth, const Color32& color);	
-	void text(const Rect2& rect, const string& text, const Color32& color);
+	void text(const Rect2& rect, string_view text, const Color32& color);
+
+	float textWidth(string_view text) const;
 
 	void render(not_null<const Graphics::Window*> window);
+	// Capture output only, replaces contents of capture but keeps its allocations
+	//	Nuklear geometry is converted every time, native layers are tessellated only when recorded
+	void capture(not_null<IMGuiCapture*> capture, const vec2i& framebufferSize);
 
 
 private:
@@ -0,0 +1,170 @@
+#include "Jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "Profiler.h"
+
+namespace jcpe
+{
+
+struct WorkerPool::State
+{
+	vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	bool quit = false;
+
+	// Current job, guarded by mutex except for index counter
+	uint64 generation = 0;
+	const std::function<void(uint)>* job = nullptr;
+	uint jobCount = 0;
+	std::atomic<uint> nextIndex;
+	uint completedCount = 0;
+	// Workers that picked up current generation and have not reported back yet
+	uint activeCount = 0;
+
+	// Guarded by mutex, oldest first
+	std::deque<std::function<void()>> backgroundJobs;
+};
+
+unique_ptr<WorkerPool> WorkerPool::create(uint workerCount)
+{
+	if (workerCount == 0)
+		workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	void* const baseAddr = malloc(sizeof(WorkerPool) + sizeof(State));
+	void* const stateAddr = (void*)((uint8*)baseAddr + sizeof(WorkerPool));
+	auto* state = new (stateAddr) State();
+	auto* obj = new (baseAddr) WorkerPool(state);
+
+	state->nextIndex = 0;
+	for (uint i = 0; i < workerCount; ++i)
+		state->threads.push_back(std::thread(&WorkerPool::workerMain, state, i));
+
+	LOG("Started " << workerCount << " worker threads");
+	return unique_ptr<WorkerPool>(obj);
+}
+
+WorkerPool::WorkerPool(State* state)
+	: m_state(state)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->quit = true;
+	}
+	m_state->wakeCondition.notify_all();
+	for (auto& thread : m_state->threads)
+		thread.join();
+
+	m_state->~State();
+}
+
+uint WorkerPool::runJobs(State& state, const std::function<void(uint)>& job, uint jobCount)
+{
+	uint completed = 0;
+	for (uint index = state.nextIndex.fetch_add(1); index < jobCount; index = state.nextIndex.fetch_add(1))
+	{
+		job(index);
+		++completed;
+	}
+	return completed;
+}
+
+void WorkerPool::workerMain(State* statePtr, uint workerIndex)
+{
+	State& state = *statePtr;
+
+	char name[32];
+	snprintf(name, array_size(name), "Worker %u", workerIndex);
+	Profiler::getProfiler()->registerThread(name);
+
+	uint64 seenGeneration = 0;
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(state.mutex);
+		state.wakeCondition.wait(lock, [&]() { 
+				return state.quit || state.generation != seenGeneration || !state.backgroundJobs.empty(); });
+		if (state.quit)
+			return;
+
+		// parallelFor work goes first, as its caller is waiting
+		if (state.generation == seenGeneration)
+		{
+			const std::function<void()> job = std::move(state.backgroundJobs.front());
+			state.backgroundJobs.pop_front();
+			lock.unlock();
+
+			job();
+			continue;
+		}
+
+		seenGeneration = state.generation;
+		const std::function<void(uint)>* job = state.job;
+		const uint jobCount = state.jobCount;
+		++state.activeCount;
+		lock.unlock();
+
+		const uint completed = job ? runJobs(state, *job, jobCount) : 0;
+
+		lock.lock();
+		state.completedCount += completed;
+		--state.activeCount;
+		state.doneCondition.notify_all();
+	}
+}
+
+uint WorkerPool::getWorkerCount() const
+{
+	return m_state->threads.size();
+}
+
+void WorkerPool::parallelFor(uint jobCount, const std::function<void(uint)>& job)
+{
+	State& state = *m_state;
+	if (jobCount == 0)
+		return;
+
+	{
+		// Workers still leaving previous generation must not see counters reset under them
+		std::unique_lock<std::mutex> lock(state.mutex);
+		state.doneCondition.wait(lock, [&]() { return state.activeCount == 0; });
+
+		state.job = &job;
+		state.jobCount = jobCount;
+		state.nextIndex = 0;
+		state.completedCount = 0;
+		++state.generation;
+	}
+	state.wakeCondition.notify_all();
+
+	const uint completed = runJobs(state, job, jobCount);
+
+	std::unique_lock<std::mutex> lock(state.mutex);
+	state.completedCount += completed;
+	state.doneCondition.wait(lock, [&]() { return state.completedCount == jobCount && state.activeCount == 0; });
+	state.job = nullptr;
+}
+
+void WorkerPool::enqueueBackground(std::function<void()> job)
+{
+	State& state = *m_state;
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.backgroundJobs.push_back(std::move(job));
+	}
+	state.wakeCondition.notify_one();
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Core.h"
+
+#include <functional>
+
+namespace jcpe
+{
+
+// Fixed set of worker threads for splitting work within a frame
+//	Workers register with the profiler, so jobs show up in the timeline
+class WorkerPool
+{
+public:
+	// Zero worker count picks one less than the number of hardware threads
+	static unique_ptr<WorkerPool> create(uint workerCount = 0);
+	~WorkerPool();
+
+	uint getWorkerCount() const;
+
+	// Runs job for each index in [0, jobCount) on workers and the calling thread, returns once all are done
+	void parallelFor(uint jobCount, const std::function<void(uint)>& job);
+
+	// Runs job on a worker without waiting for it, callable from any thread
+	//	Background jobs start in order when workers have no parallelFor work, and may span frames
+	//	Jobs not started by the time the pool is destroyed are dropped
+	void enqueueBackground(std::function<void()> job);
+
+private:
+	struct State;	
+	WorkerPool(State* state);
+
+	static void workerMain(State* state, uint workerIndex);
+	static uint runJobs(State& state, const std::function<void(uint)>& job, uint jobCount);
+
+	State* m_state;
+};
+
+}
@@ -1,5 +1,8 @@
 #include "Profiler.h"
 
+#include <atomic>
+#include <mutex>
+
 #include "ColorDefines.h"
 
 namespace jcpe
@@ -25,21 +28,84 @@ not_null<Profiler*> getProfiler()
 	return s_profiler;
 }
 
+struct SampleStackInfo
+{
+	uint index;
+	uint childCount;
+};
+
+struct ThreadState
+{
+	ThreadInfo info;
+
+	// Only touched by owning thread
+	vector<Sample> samples;
+	vector<SampleStackInfo> sampleStack;
+
+	// Completed top level samples, handed over to the current frame on endFrame
+	std::mutex completedMutex;
+	vector<Sample> completedSamples;
+};
+
+// Null for main thread
+static thread_local ThreadState* t_threadState = nullptr;
+
 // TODO: Add namespace protection or make members of class
 struct Profiler::State
 {
+	// Ring buffer of completed frames, indexed by frame number
+	//	Changed by the main thread under historyMutex, so it is only read unlocked from there
+	mutable std::mutex historyMutex;
 	vector<unique_ptr<FrameData>> history;
+	// Atomic so other threads can tell the current frame without locking history
+	std::atomic<uint64> frameCount{ 0 };
 
-	struct SampleStackInfo
-	{
-		uint index;
-		uint childCount;
-	};
 	vector<SampleStackInfo> sampleStack;
 
 	unique_ptr<FrameData> currentFrame;
+
+	mutable std::mutex threadsMutex;
+	vector<unique_ptr<ThreadState>> threads;
+
+	// Counters are collected outside of frame data, so values added between frames are not lost
+	std::mutex countersMutex;
+	vector<CounterValue> counters;
 };
 
+static not_null<Sample*> beginThreadSample(ThreadState& threadState, not_null<const SampleInfo*> info)
+{
+	auto& samples = threadState.samples;
+	auto& sampleStack = threadState.sampleStack;
+	samples.push_back(Sample(info));
+
+	if (sampleStack.size() > 0)
+		sampleStack.back().childCount++;
+
+	sampleStack.push_back(SampleStackInfo{(uint)samples.size() - 1, 0});
+	return &samples.back();
+}
+
+static void endThreadSample(ThreadState& threadState, const TimeStamp& endTime)
+{
+	auto& samples = threadState.samples;
+	auto& sampleStack = threadState.sampleStack;
+	Sample& sample = samples[sampleStack.back().index];
+
+	sample.duration = endTime - sample.startTime;
+	sample.childCount = sampleStack.back().childCount;
+	sample.descendantCount = (int)samples.size() - 1 - (int)sampleStack.back().index;
+
+	sampleStack.pop_back();
+
+	// Top level sample completed, hand over whole subtree
+	if (sampleStack.size() == 0)
+	{
+		std::lock_guard<std::mutex> lock(threadState.completedMutex);
+		threadState.completedSamples.insert(threadState.completedSamples.end(), samples.begin(), samples.end());
+		samples.clear();
+	}
+}
+
 unique_ptr<Profiler> Profiler::createProfiler()
 {
 	void* const memAddr = malloc(sizeof(Profiler) + sizeof(Profiler::State));
@@ -64,12 +130,29 @@ void Profiler::beginFrame()
 
 	// Initialize new frame
 	ASSERT_DESC(!m_state->currentFrame, "Begin frame was called again without end frame");
-	auto currentFrame = make_unique<FrameData>();
 	m_state->sampleStack.clear();
 
+	// Reuse evicted frame to avoid reallocating sample storage
+	unique_ptr<FrameData> currentFrame;
+	auto& history = m_state->history;
+	if (history.size() == kMaxHistoryFrameCount)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_state->historyMutex);
+			currentFrame = std::move(history[m_state->frameCount % kMaxHistoryFrameCount]);
+		}
+		currentFrame->samples.clear();
+		currentFrame->counters.clear();
+	}
+	else
+	{
+		currentFrame = make_unique<FrameData>();
+	}
+	currentFrame->frameNumber = m_state->frameCount;
+
 	// Root sample, encapsulates whole frame
 	currentFrame->samples.push_back(Sample(&rootInfo));
-	m_state->sampleStack.push_back(Profiler::State::SampleStackInfo{0, 0});
+	m_state->sampleStack.push_back(SampleStackInfo{0, 0});
 	Sample& sample = currentFrame->samples.back();
 
 	sample.startTime = getTime();
@@ -82,11 +165,110 @@ void Profiler::endFrame()
 	endSample(getTime());
 	ASSERT_DESC(m_state->sampleStack.size() == 0, "Unmatched sample begin/end at end of frame");
 
-	m_state->history.push_back(std::move(m_state->currentFrame));
+	// Lanes file samples of the current frame into it until the frame is in history, so collect under the same lock
+	std::lock_guard<std::mutex> historyLock(m_state->historyMutex);
+
+	// Collect samples completed on other threads
+	{
+		std::lock_guard<std::mutex> lock(m_state->threadsMutex);
+		auto& frameThreads = m_state->currentFrame->threads;
+		frameThreads.resize(m_state->threads.size());
+		for (uint i = 0; i < frameThreads.size(); ++i)
+		{
+			ThreadState& threadState = *m_state->threads[i];
+			ThreadSamples& threadSamples = frameThreads[i];
+			threadSamples.thread = &threadState.info;
+			threadSamples.samples.clear();
+
+			std::lock_guard<std::mutex> completedLock(threadState.completedMutex);
+			std::swap(threadSamples.samples, threadState.completedSamples);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_state->countersMutex);
+		std::swap(m_state->currentFrame->counters, m_state->counters);
+	}
+
+	auto& history = m_state->history;
+	if (history.size() < kMaxHistoryFrameCount)
+		history.push_back(std::move(m_state->currentFrame));
+	else
+		history[m_state->frameCount % kMaxHistoryFrameCount] = std::move(m_state->currentFrame);
+
+	++m_state->frameCount;
+}
+
+void Profiler::registerThread(const string& name)
+{
+	ASSERT_DESC(!t_threadState, "Thread is already registered");
+
+	auto threadState = make_unique<ThreadState>();
+	threadState->info.name = name;
+	t_threadState = threadState.get();
+
+	std::lock_guard<std::mutex> lock(m_state->threadsMutex);
+	m_state->threads.push_back(std::move(threadState));
+}
+
+uint Profiler::registerLane(const string& name)
+{
+	auto threadState = make_unique<ThreadState>();
+	threadState->info.name = name;
+
+	std::lock_guard<std::mutex> lock(m_state->threadsMutex);
+	m_state->threads.push_back(std::move(threadState));
+	return m_state->threads.size() - 1;
+}
+
+void Profiler::submitLaneSamples(uint lane, uint64 frameNumber, const span<const Sample>& samples)
+{
+	std::lock_guard<std::mutex> historyLock(m_state->historyMutex);
+
+	ThreadState* threadState;
+	{
+		std::lock_guard<std::mutex> lock(m_state->threadsMutex);
+		ASSERT_DESC(lane < m_state->threads.size(), "Invalid profiler lane");
+		threadState = m_state->threads[lane].get();
+	}
+
+	// Current frame collects them when it ends
+	const uint64 frameCount = m_state->frameCount;
+	ASSERT_DESC(frameNumber <= frameCount, "Lane samples submitted for a frame not begun yet");
+	if (frameNumber == frameCount)
+	{
+		std::lock_guard<std::mutex> lock(threadState->completedMutex);
+		threadState->completedSamples.insert(threadState->completedSamples.end(), samples.begin(), samples.end());
+		return;
+	}
+
+	// Dropped if the frame has left history, or its slot is being reused for the current frame
+	auto& history = m_state->history;
+	if (frameCount - frameNumber > history.size())
+		return;
+	FrameData* const frameData = history[frameNumber % kMaxHistoryFrameCount].get();
+	if (!frameData)
+		return;
+
+	// Frame may have ended before the lane was registered
+	if (frameData->threads.size() <= lane)
+		frameData->threads.resize(lane + 1);
+	ThreadSamples& threadSamples = frameData->threads[lane];
+	threadSamples.thread = &threadState->info;
+	threadSamples.samples.insert(threadSamples.samples.end(), samples.begin(), samples.end());
+}
+
+uint Profiler::getThreadCount() const
+{
+	std::lock_guard<std::mutex> lock(m_state->threadsMutex);
+	return m_state->threads.size();
 }
 
 not_null<Sample*> Profiler::beginSampleWithoutStartTime(not_null<const SampleInfo*> info)
 {
+	if (t_threadState)
+		return beginThreadSample(*t_threadState, info);
+
 	FrameData* currentFrame = m_state->currentFrame;
 	FATAL_ASSERT_DESC(currentFrame, "No active profiler frame, make sure begin/endFrame is being called");
 	currentFrame->samples.push_back(Sample(info));
@@ -97,7 +279,7 @@ not_null<Sample*> Profiler::beginSampleWithoutStartTime(not_null<const SampleInf
 	sampleStack.back().childCount++;
 
 	// TODO: Investigate push_back() uninit
-	sampleStack.push_back(Profiler::State::SampleStackInfo{(uint)currentFrame->samples.size() - 1, 0});
+	sampleStack.push_back(SampleStackInfo{(uint)currentFrame->samples.size() - 1, 0});
 	Sample& sample = currentFrame->samples.back();
 
 	return &sample;
@@ -105,23 +287,80 @@ not_null<Sample*> Profiler::beginSampleWithoutStartTime(not_null<const SampleInf
 
 void Profiler::endSample(const TimeStamp& endTime)
 {
+	if (t_threadState)
+	{
+		endThreadSample(*t_threadState, endTime);
+		return;
+	}
+
 	FrameData* currentFrame = m_state->currentFrame;
 	auto& sampleStack = m_state->sampleStack;
 	Sample& sample = currentFrame->samples[sampleStack.back().index];
 
 	sample.duration = endTime - sample.startTime;
 	sample.childCount = sampleStack.back().childCount;
+	sample.descendantCount = (int)currentFrame->samples.size() - 1 - (int)sampleStack.back().index;
 
 	sampleStack.pop_back();	
 }
 
+void Profiler::addCounterValue(not_null<const CounterInfo*> info, int64 value)
+{
+	std::lock_guard<std::mutex> lock(m_state->countersMutex);
+	for (auto& counter : m_state->counters)
+	{
+		if (counter.info == info)
+		{
+			counter.value += value;
+			return;
+		}
+	}
+	m_state->counters.push_back(CounterValue(info, value));
+}
+
+std::unique_lock<std::mutex> Profiler::lockHistory() const
+{
+	return std::unique_lock<std::mutex>(m_state->historyMutex);
+}
+
 const FrameData* Profiler::getLastFrameData()
 {
-	if (m_state->history.size() > 0)
-		return m_state->history.back();
+	if (m_state->frameCount > 0)
+		return getFrameData(m_state->frameCount - 1);
 	return nullptr;
 }
 
+uint64 Profiler::getFrameCount() const
+{
+	return m_state->frameCount;
+}
+
+uint64 Profiler::getOldestFrameNumber() const
+{
+	// During a frame, the oldest slot may have been recycled for the current frame
+	const auto& history = m_state->history;
+	const uint64 oldest = m_state->frameCount - history.size();
+	if (history.size() > 0 && history[oldest % kMaxHistoryFrameCount].get() == nullptr)
+		return oldest + 1;
+	return oldest;
+}
+
+const FrameData* Profiler::getFrameData(uint64 frameNumber) const
+{
+	if (frameNumber < getOldestFrameNumber() || frameNumber >= m_state->frameCount)
+		return nullptr;
+	return m_state->history[frameNumber % kMaxHistoryFrameCount].get();
+}
+
+Color32 frameTimeColor(float ms)
+{
+	if (ms > kFrameBudgetMs[1])
+		return Color::kRed;
+	if (ms > kFrameBudgetMs[0])
+		return Color::kOrange;
+	return Color::kGreen;
+}
+
 } // namespace Profiler
 
 }
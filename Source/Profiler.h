@@ -1,5 +1,8 @@
+#pragma once
+
 #include "Core.h"
 #include <chrono>
+#include <mutex>
 
 namespace jcpe
 {
@@ -26,16 +29,52 @@ struct Sample
 	TimeStamp startTime;
 	Duration duration;
 	int childCount;
+	// Number of samples in subtree, excluding this one
+	//	Allows skipping whole subtrees when walking preorder data
+	int descendantCount;
 	not_null<const SampleInfo*> info;
 
 	Sample(not_null<const SampleInfo*> info) : info(info) {}
 };
 
+struct CounterInfo
+{
+	string name;
+};
+
+struct CounterValue
+{
+	not_null<const CounterInfo*> info;
+	int64 value;
+
+	CounterValue(not_null<const CounterInfo*> info, int64 value) : info(info), value(value) {}
+};
+
+struct ThreadInfo
+{
+	string name;
+};
+
+struct ThreadSamples
+{
+	const ThreadInfo* thread = nullptr;
+	// Top level samples completed during the frame, each followed by its subtree in preorder
+	vector<Sample> samples;
+};
+
 struct FrameData
 {
-	// Sample tree stored in a Preorder traversal
+	uint64 frameNumber;
+
+	// Sample tree of the main thread stored in a Preorder traversal
 	//	First sample is root sampe, encompassing whole frame
 	vector<Sample> samples;
+
+	// Samples of other registered threads and lanes, indexed in order of registration
+	vector<ThreadSamples> threads;
+
+	// Counter totals for the frame, in order of first use
+	vector<CounterValue> counters;
 };
 
 class Profiler
@@ -48,12 +87,34 @@ public:
 	void beginFrame();
 	void endFrame();
 
+	// Threads other than the main thread must register before sampling
+	void registerThread(const string& name);
+	uint getThreadCount() const;
+
+	// Lanes are listed with threads, for samples timed elsewhere (i.e. on the GPU) and submitted afterwards
+	uint registerLane(const string& name);
+	// Top level samples, each followed by its subtree in preorder, filed into the given frame even if it has ended
+	//	Callable from any thread, but not while holding lockHistory
+	void submitLaneSamples(uint lane, uint64 frameNumber, const span<const Sample>& samples);
+
 	// TODO: shared_ptr profiler info?
 	not_null<Sample*> beginSampleWithoutStartTime(not_null<const SampleInfo*> info);
 	void endSample(const TimeStamp& endTime);
 
+	// Accumulates into the counter total of the current frame, callable from any thread
+	void addCounterValue(not_null<const CounterInfo*> info, int64 value);
+
+	// Begin/endFrame change history, threads other than the main thread have to hold this while reading it
+	std::unique_lock<std::mutex> lockHistory() const;
+
 	const FrameData* getLastFrameData();
 
+	// Frames are numbered in order of completion, only the most recent ones are kept in history
+	//	Frame count is also the number of the frame in progress, and can be read from any thread
+	uint64 getFrameCount() const;
+	uint64 getOldestFrameNumber() const;
+	const FrameData* getFrameData(uint64 frameNumber) const;
+
 private:
 	Profiler(void* stateMemAddr);
 
@@ -65,6 +126,14 @@ private:
 void setProfiler(not_null<Profiler*> profiler);
 not_null<Profiler*> getProfiler();
 
+static const uint kMaxHistoryFrameCount = 256;
+
+// Frame time budgets at 60 and 30 fps
+static const float kFrameBudgetMs[] = { 1000.0f / 60.0f, 1000.0f / 30.0f };
+
+// Green within 60 fps budget, orange within 30 fps budget, red above
+Color32 frameTimeColor(float ms);
+
 extern const CategoryInfo kProfilerCategoryProfiler;
 extern const CategoryInfo kProfilerCategoryIdle;
 extern const CategoryInfo kProfilerCategoryUncategorized;
@@ -92,6 +161,10 @@ inline TimeStamp getTime()
 #define PROFILER_SCOPE_NAME(name)																   \
 	PROFLIER_SCOPE_NAME_CATEGORY(name, &Profiler::kProfilerCategoryUncategorized)
 
+#define PROFILER_COUNTER_ADD(name, value)														   \
+	do { static const Profiler::CounterInfo counterInfo{ name };								   \
+		Profiler::getProfiler()->addCounterValue(&counterInfo, value); } while (false)
+
 // Macro trickety, choose function name based on arg count
 #define GET_3TH_ARG(arg1, arg2, arg3, ...) arg3
 
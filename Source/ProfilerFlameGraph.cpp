@@ -0,0 +1,216 @@
+#include "ProfilerFlameGraph.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "Profiler.h"
+#include "IMGui.h"
+#include "ColorDefines.h"
+
+namespace jcpe
+{
+
+namespace profilerFlameGraph
+{
+	// Has to fit in profiler history, since leaving frames are read back from it
+	static const uint kWindowFrameCount = 60;
+	static_assert(kWindowFrameCount < Profiler::kMaxHistoryFrameCount, "Flame graph window must fit in profiler history");
+
+	static const float kRowHeight = 16.0f;
+	static const float kMinNodeWidth = 1.0f;
+	static const float kLabelPadding = 4.0f;
+
+	static const int kInvalidNode = -1;
+
+	struct Node
+	{
+		const Profiler::SampleInfo* info;
+		int firstChild;
+		int nextSibling;
+		// Sum over all frames in window
+		Profiler::Duration totalDuration;
+	};
+
+	struct DrawItem
+	{
+		int node;
+		float x;
+		uint depth;
+	};
+}
+
+struct ProfilerFlameGraph::State
+{
+	// Node 0 is the root, merged from root sample of every frame
+	vector<profilerFlameGraph::Node> nodes;
+	uint64 windowEndFrameNumber = 0;
+	uint windowFrameCount = 0;
+
+	vector<int> nodeStack;
+	vector<uint> subtreeEndStack;
+	vector<profilerFlameGraph::DrawItem> drawStack;
+
+	std::unordered_map<const Profiler::SampleInfo*, float> labelWidths;
+};
+
+
+unique_ptr<ProfilerFlameGraph> ProfilerFlameGraph::create()
+{
+	void* const baseAddr = malloc(sizeof(ProfilerFlameGraph) + sizeof(State));
+	void* const stateAddr = (void*)((uint8*)baseAddr + sizeof(ProfilerFlameGraph));
+
+	auto* state = new (stateAddr) State();
+	auto* obj = new (baseAddr) ProfilerFlameGraph(state);
+	return unique_ptr<ProfilerFlameGraph>(obj);
+}
+
+ProfilerFlameGraph::ProfilerFlameGraph(State* state)
+	: m_state(state)
+{
+}
+
+ProfilerFlameGraph::~ProfilerFlameGraph()
+{
+	m_state->~State();
+}
+
+void ProfilerFlameGraph::accumulateFrame(const Profiler::FrameData& frameData, int sign)
+{
+	using namespace profilerFlameGraph;
+
+	auto& nodes = m_state->nodes;
+	auto& nodeStack = m_state->nodeStack;
+	auto& subtreeEndStack = m_state->subtreeEndStack;
+	nodeStack.clear();
+	subtreeEndStack.clear();
+
+	const auto& samples = frameData.samples;
+	for (uint index = 0; index < samples.size(); ++index)
+	{
+		while (subtreeEndStack.size() > 0 && index >= subtreeEndStack.back())
+		{
+			subtreeEndStack.pop_back();
+			nodeStack.pop_back();
+		}
+
+		const auto& sample = samples[index];
+		const Profiler::SampleInfo* sampleInfo = sample.info.get();
+
+		// Find node for path, children lists are short so a linear search will do
+		int nodeIndex = 0;
+		if (nodeStack.size() > 0)
+		{
+			const int parentIndex = nodeStack.back();
+			int prevIndex = kInvalidNode;
+			nodeIndex = nodes[parentIndex].firstChild;
+			while (nodeIndex != kInvalidNode && nodes[nodeIndex].info != sampleInfo)
+			{
+				prevIndex = nodeIndex;
+				nodeIndex = nodes[nodeIndex].nextSibling;
+			}
+
+			if (nodeIndex == kInvalidNode)
+			{
+				nodeIndex = nodes.size();
+				nodes.push_back(Node{ sampleInfo, kInvalidNode, kInvalidNode, Profiler::Duration(0) });
+				if (prevIndex == kInvalidNode)
+					nodes[parentIndex].firstChild = nodeIndex;
+				else
+					nodes[prevIndex].nextSibling = nodeIndex;
+			}
+		}
+		else if (nodes.size() == 0)
+		{
+			nodes.push_back(Node{ sampleInfo, kInvalidNode, kInvalidNode, Profiler::Duration(0) });
+		}
+
+		nodes[nodeIndex].totalDuration += sample.duration * sign;
+
+		nodeStack.push_back(nodeIndex);
+		subtreeEndStack.push_back(index + 1 + sample.descendantCount);
+	}
+}
+
+void ProfilerFlameGraph::update()
+{
+	using namespace profilerFlameGraph;
+
+	State& state = *m_state;
+	const auto profiler = Profiler::getProfiler();
+	const uint64 frameCount = profiler->getFrameCount();
+
+	// Start over if window has fallen out of history, e.g. when not drawn for a while
+	const uint64 firstWindowFrame = state.windowEndFrameNumber - state.windowFrameCount;
+	if (firstWindowFrame < profiler->getOldestFrameNumber())
+	{
+		state.nodes.clear();
+		state.windowFrameCount = 0;
+		state.windowEndFrameNumber = std::max(profiler->getOldestFrameNumber(), 
+				frameCount > kWindowFrameCount ? frameCount - kWindowFrameCount : 0);
+	}
+
+	for (; state.windowEndFrameNumber < frameCount; ++state.windowEndFrameNumber)
+	{
+		const uint64 frameNumber = state.windowEndFrameNumber;
+		accumulateFrame(*profiler->getFrameData(frameNumber), 1);
+
+		if (state.windowFrameCount == kWindowFrameCount)
+			accumulateFrame(*profiler->getFrameData(frameNumber - kWindowFrameCount), -1);
+		else
+			++state.windowFrameCount;
+	}
+}
+
+void ProfilerFlameGraph::draw(not_null<IMGui*> gui, const Rect2& area)
+{
+	PROFILER_SCOPE("ProfilerFlameGraphDraw", &Profiler::kProfilerCategoryProfiler);
+
+	using namespace profilerFlameGraph;
+
+	update();
+
+	State& state = *m_state;
+	const auto& nodes = state.nodes;
+
+	gui->filledRect(area, Color32(0,0,0,0.5f));
+
+	if (nodes.size() == 0 || nodes[0].totalDuration.count() <= 0)
+		return;
+
+	// Widths are relative to the average root duration, so averaging cancels out
+	const float pixelsPerTick = area.width() / (float)nodes[0].totalDuration.count();
+	const uint maxDepth = (uint)(area.height() / kRowHeight);
+
+	// Root at the bottom, children stacked on top of their parent
+	auto& drawStack = state.drawStack;
+	drawStack.clear();
+	drawStack.push_back(DrawItem{ 0, area.x, 0 });
+	while (drawStack.size() > 0)
+	{
+		const DrawItem item = drawStack.back();
+		drawStack.pop_back();
+
+		const Node& node = nodes[item.node];
+		const float width = node.totalDuration.count() * pixelsPerTick;
+		if (width < kMinNodeWidth || item.depth >= maxDepth)
+			continue;
+
+		const Rect2 rect = Rect2(item.x, area.y2 - (item.depth + 1) * kRowHeight, width, kRowHeight - 1.0f);
+		gui->filledRect(rect, node.info->category->color);
+
+		auto labelWidthIt = state.labelWidths.find(node.info);
+		if (labelWidthIt == state.labelWidths.end())
+			labelWidthIt = state.labelWidths.emplace(node.info, gui->textWidth(node.info->name)).first;
+		if (width >= labelWidthIt->second + kLabelPadding * 2)
+			gui->text(rect, node.info->name, Color32(0,0,0,1));
+
+		float childX = item.x;
+		for (int child = node.firstChild; child != kInvalidNode; child = nodes[child].nextSibling)
+		{
+			drawStack.push_back(DrawItem{ child, childX, item.depth + 1 });
+			childX += nodes[child].totalDuration.count() * pixelsPerTick;
+		}
+	}
+}
+
+}
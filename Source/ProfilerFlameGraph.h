@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Core.h"
+
+namespace jcpe
+{
+
+class IMGui;
+namespace Profiler
+{
+	struct FrameData;
+}
+
+// Merges call trees of recent frames by sample path, showing average cost of each path
+//	Updated incrementally, frames entering the window are added and frames leaving it are subtracted
+class ProfilerFlameGraph
+{
+public:
+	static unique_ptr<ProfilerFlameGraph> create();
+	~ProfilerFlameGraph();
+
+	void draw(not_null<IMGui*> gui, const Rect2& area);
+
+private:
+	struct State;	
+	ProfilerFlameGraph(State* state);
+
+	void update();
+	void accumulateFrame(const Profiler::FrameData& frameData, int sign);
+
+	State* m_state;
+};
+
+
+}
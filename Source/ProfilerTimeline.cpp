@@ -1,5 +1,10 @@
 #include "ProfilerTimeline.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+
 #include "Profiler.h"
 #include "IMGui.h"
 #include "ColorDefines.h"
@@ -7,9 +12,83 @@
 namespace jcpe
 {
 
+namespace profilerTimeline
+{
+	static const float kRowHeight = 16.0f;
+	// Samples narrower than this are merged into aggregated blocks
+	static const float kMinSampleWidth = 1.0f;
+	// Max gap between sub-pixel samples for them to be merged into the same block
+	static const float kMergeGap = 1.0f;
+	static const float kLabelPadding = 4.0f;
+	// Primitive budget for each row (rects and texts), keeps cost bounded for any sample count
+	static const uint kMaxPrimitivesPerRow = 256;
+
+	static const float kStripHeight = 48.0f;
+	static const float kStripMargin = 4.0f;
+	// Frame time mapped to full strip height
+	static const float kStripMaxFrameTimeMs = 50.0f;
+	static const float kZoomStep = 1.25f;
+	static const Profiler::Duration kMinViewDuration = std::chrono::microseconds(10);
+
+	// Main thread lane first, then one lane per registered thread
+	static const float kLaneLabelWidth = 80.0f;
+	static const float kLaneMargin = 4.0f;
+	static const uint kThreadLaneRowCount = 4;
+
+	struct MergedBlock
+	{
+		float x1;
+		float x2;
+		uint sampleCount;
+		const Profiler::CategoryInfo* category;
+	};
+
+	struct Row
+	{
+		MergedBlock pendingBlock;
+		uint primitiveCount;
+		float y;
+	};
+
+	struct Lane
+	{
+		uint firstRow;
+		uint rowCount;
+		const char* name;
+	};
+
+	static Profiler::Duration scaleDuration(const Profiler::Duration& duration, double scale)
+	{
+		return Profiler::Duration((Profiler::Duration::rep)(duration.count() * scale));
+	}
+
+	static float toMs(const Profiler::Duration& duration)
+	{
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+}
+
 struct ProfilerTimeline::State
 {
-	int lol;
+	// Label widths are stable per sample info, so only measure once
+	std::unordered_map<const Profiler::SampleInfo*, float> labelWidths;
+
+	vector<profilerTimeline::Lane> lanes;
+	vector<profilerTimeline::Row> rows;
+	vector<uint> subtreeEndStack;
+
+	// Visible time range, tracks the newest frame while live
+	bool live = true;
+	Profiler::TimeStamp viewStart;
+	Profiler::Duration viewDuration = Profiler::Duration(0);
+	double pixelsPerTick = 0;
+
+	bool hasSelectedFrame = false;
+	uint64 selectedFrameNumber = 0;
+	// Frame after the newest one in the strip, follows frame count while live and stays put while paused
+	uint64 stripEndFrameNumber = 0;
+
+	bool dragging = false;
 };
 
 
@@ -30,53 +109,383 @@ ProfilerTimeline::ProfilerTimeline(State* state)
 
 ProfilerTimeline::~ProfilerTimeline()
 {
+	m_state->~State();
 }
 
-void ProfilerTimeline::draw(not_null<IMGui*> gui)
+static void flushMergedBlock(not_null<IMGui*> gui, profilerTimeline::Row& row)
 {
-	PROFILER_SCOPE("ProfilerTimelineDraw", &Profiler::kProfilerCategoryProfiler);
+	using namespace profilerTimeline;
 
-	const vec2 size(800, 600);
+	MergedBlock& block = row.pendingBlock;
+	if (block.sampleCount == 0)
+		return;
 
-	gui->filledRect(Rect2(0, 0, size), Color32(0,0,0,0.5f));
+	if (row.primitiveCount < kMaxPrimitivesPerRow)
+	{
+		// Blocks of mixed categories have no single meaningful color
+		const Color32 color = block.category ? block.category->color : Color::kGray;
+		const float width = math::max(block.x2 - block.x1, kMinSampleWidth);
+		gui->filledRect(Rect2(block.x1, row.y, width, kRowHeight), color);
+		++row.primitiveCount;
+	}
+
+	block.sampleCount = 0;
+}
+
+static void layoutTimeline(const Rect2& area, Rect2* stripRect, Rect2* timelineRect)
+{
+	using namespace profilerTimeline;
+
+	const float timelineY = area.y + kStripHeight + kStripMargin;
+	*stripRect = Rect2(area.x, area.y, area.width(), kStripHeight);
+	*timelineRect = Rect2(area.x + kLaneLabelWidth, timelineY, area.width() - kLaneLabelWidth, area.y2 - timelineY);
+}
+
+void ProfilerTimeline::update(not_null<IMGui*> gui, const Rect2& area)
+{
+	PROFILER_SCOPE("ProfilerTimelineUpdate", &Profiler::kProfilerCategoryProfiler);
 
 	const auto profiler = Profiler::getProfiler();
-	const auto frameData = profiler->getLastFrameData();
+	const auto lastFrameData = profiler->getLastFrameData();
 
-	if (!frameData)
+	if (!lastFrameData)
 		return;
 
-	ASSERT(frameData->samples.size() > 0);
+	ASSERT(lastFrameData->samples.size() > 0);
+
+	Rect2 stripRect = area;
+	Rect2 timelineRect = area;
+	layoutTimeline(area, &stripRect, &timelineRect);
+
+	if (m_state->viewDuration.count() == 0)
+		m_state->viewDuration = lastFrameData->samples[0].duration;
+
+	handleInput(gui, stripRect, timelineRect);
+
+	if (m_state->live)
+	{
+		const auto& root = lastFrameData->samples[0];
+		m_state->viewStart = (root.startTime + root.duration) - m_state->viewDuration;
+		m_state->stripEndFrameNumber = profiler->getFrameCount();
+	}
+	m_state->pixelsPerTick = timelineRect.width() / (double)m_state->viewDuration.count();
+}
+
+void ProfilerTimeline::draw(not_null<IMGui*> gui, const Rect2& area)
+{
+	PROFILER_SCOPE("ProfilerTimelineDraw", &Profiler::kProfilerCategoryProfiler);
+
+	gui->filledRect(area, Color32(0,0,0,0.5f));
+
+	if (!Profiler::getProfiler()->getLastFrameData())
+		return;
+
+	Rect2 stripRect = area;
+	Rect2 timelineRect = area;
+	layoutTimeline(area, &stripRect, &timelineRect);
+
+	drawFrameStrip(gui, stripRect);
+	drawTimeline(gui, timelineRect);
+}
+
+bool ProfilerTimeline::isLive() const
+{
+	return m_state->live;
+}
+
+uint64 ProfilerTimeline::getViewHash() const
+{
+	const State& state = *m_state;
+	const int64 viewStart = state.viewStart.time_since_epoch().count();
+	const int64 viewDuration = state.viewDuration.count();
+	uint64 hash = hashMemory(&state.live, sizeof(state.live));
+	hash = hashMemory(&state.hasSelectedFrame, sizeof(state.hasSelectedFrame), hash);
+	hash = hashMemory(&state.selectedFrameNumber, sizeof(state.selectedFrameNumber), hash);
+	hash = hashMemory(&state.stripEndFrameNumber, sizeof(state.stripEndFrameNumber), hash);
+	hash = hashMemory(&viewStart, sizeof(viewStart), hash);
+	return hashMemory(&viewDuration, sizeof(viewDuration), hash);
+}
+
+void ProfilerTimeline::handleInput(not_null<IMGui*> gui, const Rect2& stripRect, const Rect2& timelineRect)
+{
+	using namespace profilerTimeline;
+
+	State& state = *m_state;
+	const auto profiler = Profiler::getProfiler();
+	const vec2 mousePos = gui->getMousePosition();
+
+	// Select frame from strip, freezing the view on it
+	if (gui->isMouseClicked(MouseButton::Left, stripRect))
+	{
+		const float slotWidth = stripRect.width() / Profiler::kMaxHistoryFrameCount;
+		const int64 slot = (int64)((mousePos.x - stripRect.x) / slotWidth);
+		const int64 frameNumber = (int64)state.stripEndFrameNumber - (int64)Profiler::kMaxHistoryFrameCount + slot;
+		const auto frameData = frameNumber >= 0 ? profiler->getFrameData((uint64)frameNumber) : nullptr;
+		if (frameData)
+		{
+			const auto& root = frameData->samples[0];
+			state.live = false;
+			state.hasSelectedFrame = true;
+			state.selectedFrameNumber = frameData->frameNumber;
+			state.viewStart = root.startTime;
+			state.viewDuration = root.duration;
+		}
+	}
+
+	if (gui->isMouseClicked(MouseButton::Right, stripRect) || gui->isMouseClicked(MouseButton::Right, timelineRect))
+	{
+		state.live = true;
+		state.hasSelectedFrame = false;
+	}
+
+	const float scroll = gui->getMouseScroll();
+	if (scroll != 0 && gui->isMouseHovering(timelineRect))
+	{
+		// Zoom around mouse
+		const double mouseFraction = (mousePos.x - timelineRect.x) / timelineRect.width();
+		const auto mouseTime = state.viewStart + scaleDuration(state.viewDuration, mouseFraction);
+		const auto newDuration = std::max(scaleDuration(state.viewDuration, std::pow(kZoomStep, -scroll)), kMinViewDuration);
+		state.viewDuration = newDuration;
+		state.viewStart = mouseTime - scaleDuration(newDuration, mouseFraction);
+	}
+
+	if (gui->isMouseClicked(MouseButton::Left, timelineRect))
+		state.dragging = true;
+	if (!gui->isMouseDown(MouseButton::Left))
+		state.dragging = false;
+
+	if (state.dragging && state.pixelsPerTick > 0)
+	{
+		const float deltaX = gui->getMouseDelta().x;
+		if (deltaX != 0)
+		{
+			state.live = false;
+			state.viewStart -= Profiler::Duration((Profiler::Duration::rep)(deltaX / state.pixelsPerTick));
+		}
+	}
+}
 
-	const auto frameStart = frameData->samples[0].startTime;
-	const auto frameLength = frameData->samples[0].duration;
-	const float invFrameLength = 1.0f/(float)frameLength.count();
+void ProfilerTimeline::drawFrameStrip(not_null<IMGui*> gui, const Rect2& rect)
+{
+	using namespace profilerTimeline;
+
+	const State& state = *m_state;
+	const auto profiler = Profiler::getProfiler();
+	const uint64 frameCount = state.stripEndFrameNumber;
+	const float slotWidth = rect.width() / Profiler::kMaxHistoryFrameCount;
+	const auto viewEnd = state.viewStart + state.viewDuration;
 
-	vector<int> childCountStack;
-	childCountStack.push_back(1);
-	for (const auto& sample : frameData->samples)
+	gui->filledRect(rect, Color32(0,0,0,0.5f));
+
+	// Newest frame in the rightmost slot
+	for (uint64 frameNumber = profiler->getOldestFrameNumber(); frameNumber < frameCount; ++frameNumber)
 	{
-		const int depth = childCountStack.size() - 1;
-		const auto relStart = sample.startTime - frameStart;
-		const Point2 sPos = Point2((relStart.count() * invFrameLength) * size.x, depth * 16);
-		const vec2 sSize = vec2((sample.duration.count() * invFrameLength) * size.x, 16);
-		Color32 color = sample.info->category->color;
-		gui->filledRect(Rect2(sPos, sSize), color);
-		gui->text(Rect2(sPos, sSize), sample.info->name, Color32(0,0,0,1));
+		const auto frameData = profiler->getFrameData(frameNumber);
+		if (!frameData)
+			continue;
+
+		const auto& root = frameData->samples[0];
+		const float ms = toMs(root.duration);
+		const float height = math::min(ms / kStripMaxFrameTimeMs, 1.0f) * rect.height();
+		const float x = rect.x + (Profiler::kMaxHistoryFrameCount - (frameCount - frameNumber)) * slotWidth;
+
+		// Dim frames outside of view
+		Color32 color = Profiler::frameTimeColor(ms);
+		const bool inView = root.startTime < viewEnd && root.startTime + root.duration > state.viewStart;
+		if (!inView)
+			color.a = 0.4f;
+
+		gui->filledRect(Rect2(x, rect.y2 - height, math::max(slotWidth - 1.0f, 1.0f), height), color);
+
+		if (state.hasSelectedFrame && frameNumber == state.selectedFrameNumber)
+			gui->filledRect(Rect2(x, rect.y, math::max(slotWidth - 1.0f, 1.0f), 2.0f), Color::kWhite);
+	}
 
-		if (sample.childCount > 0)
+	char label[64];
+	if (state.live)
+		snprintf(label, array_size(label), "Live, %.2f ms", toMs(state.viewDuration));
+	else if (state.hasSelectedFrame)
+		snprintf(label, array_size(label), "Frame %llu, %.2f ms", (unsigned long long)state.selectedFrameNumber, toMs(state.viewDuration));
+	else
+		snprintf(label, array_size(label), "Paused, %.2f ms", toMs(state.viewDuration));
+	gui->text(Rect2(rect.x2 - 200.0f, rect.y, 200.0f, kRowHeight), label, Color::kWhite);
+
+	// Counters of selected frame, or newest one in strip
+	const Profiler::FrameData* counterFrame = state.hasSelectedFrame && !state.live ? 
+			profiler->getFrameData(state.selectedFrameNumber) : profiler->getFrameData(frameCount - 1);
+	if (counterFrame)
+	{
+		float x = rect.x + kLabelPadding;
+		for (const auto& counter : counterFrame->counters)
 		{
-			childCountStack.push_back(sample.childCount);
+			char counterLabel[64];
+			snprintf(counterLabel, array_size(counterLabel), "%s: %lld", counter.info->name.c_str(), (long long)counter.value);
+			const float width = gui->textWidth(counterLabel);
+			gui->text(Rect2(x, rect.y, width, kRowHeight), counterLabel, Color::kWhite);
+			x += width + kLabelPadding * 4;
 		}
+	}
+}
+
+void ProfilerTimeline::drawTimeline(not_null<IMGui*> gui, const Rect2& rect)
+{
+	using namespace profilerTimeline;
+
+	const auto profiler = Profiler::getProfiler();
+	const uint64 frameCount = profiler->getFrameCount();
+	const auto lastFrameData = profiler->getLastFrameData();
+	const auto viewStart = m_state->viewStart;
+	const auto viewEnd = viewStart + m_state->viewDuration;
+
+	// Lay out lanes, main thread lane gets the rows left over by thread lanes
+	const uint threadCount = lastFrameData->threads.size();
+	const uint totalRowCount = (uint)(math::max(rect.height() - threadCount * kLaneMargin, 0.0f) / kRowHeight);
+	const uint threadRowCount = math::min(threadCount * kThreadLaneRowCount, totalRowCount / 2);
+	const uint threadLaneRowCount = threadCount > 0 ? threadRowCount / threadCount : 0;
+
+	auto& lanes = m_state->lanes;
+	lanes.clear();
+	lanes.push_back(Lane{ 0, totalRowCount - threadLaneRowCount * threadCount, "Main" });
+	for (uint i = 0; i < threadCount; ++i)
+	{
+		const Lane& prevLane = lanes.back();
+		lanes.push_back(Lane{ prevLane.firstRow + prevLane.rowCount, threadLaneRowCount, 
+				lastFrameData->threads[i].thread->name.c_str() });
+	}
+
+	auto& rows = m_state->rows;
+	rows.clear();
+	float laneY = rect.y;
+	for (const Lane& lane : lanes)
+	{
+		// Lane background makes idle gaps visible
+		gui->filledRect(Rect2(rect.x, laneY, rect.width(), lane.rowCount * kRowHeight), Color32(1,1,1,0.1f));
+		gui->text(Rect2(rect.x - kLaneLabelWidth, laneY, kLaneLabelWidth, kRowHeight), lane.name, Color::kWhite);
+
+		for (uint row = 0; row < lane.rowCount; ++row)
+			rows.push_back(Row{ MergedBlock{ 0, 0, 0, nullptr }, 0, laneY + row * kRowHeight });
+		laneY += lane.rowCount * kRowHeight + kLaneMargin;
+	}
+
+	// Frames are ordered in time, binary search for first frame ending after view start
+	uint64 first = profiler->getOldestFrameNumber();
+	uint64 last = frameCount;
+	while (first < last)
+	{
+		const uint64 mid = first + (last - first) / 2;
+		const auto frameData = profiler->getFrameData(mid);
+		const auto& root = frameData->samples[0];
+		if (root.startTime + root.duration < viewStart)
+			first = mid + 1;
 		else
+			last = mid;
+	}
+
+	// Thread samples are filed with the frame they complete in, so frames starting after view end may still hold some in view
+	for (uint64 frameNumber = first; frameNumber < frameCount; ++frameNumber)
+	{
+		const auto frameData = profiler->getFrameData(frameNumber);
+		if (frameData->samples[0].startTime <= viewEnd)
+			drawFrameSamples(gui, frameData->samples, lanes[0], rect);
+		for (uint i = 0; i < frameData->threads.size() && i + 1 < lanes.size(); ++i)
+			drawFrameSamples(gui, frameData->threads[i].samples, lanes[i + 1], rect);
+	}
+
+	for (Row& row : rows)
+		flushMergedBlock(gui, row);
+}
+
+void ProfilerTimeline::drawFrameSamples(not_null<IMGui*> gui, const vector<Profiler::Sample>& samples, 
+		const profilerTimeline::Lane& lane, const Rect2& rect)
+{
+	using namespace profilerTimeline;
+
+	auto& rows = m_state->rows;
+	const auto viewStart = m_state->viewStart;
+	const double pixelsPerTick = m_state->pixelsPerTick;
+
+	// Depth is tracked as a stack of subtree end indices, so that whole subtrees can be skipped
+	auto& subtreeEndStack = m_state->subtreeEndStack;
+	subtreeEndStack.clear();
+
+	const uint sampleCount = samples.size();
+	uint index = 0;
+	while (index < sampleCount)
+	{
+		while (subtreeEndStack.size() > 0 && index >= subtreeEndStack.back())
+			subtreeEndStack.pop_back();
+
+		const auto& sample = samples[index];
+		const uint depth = subtreeEndStack.size();
+		const uint subtreeEnd = index + 1 + sample.descendantCount;
+
+		if (depth >= lane.rowCount)
+		{
+			index = subtreeEnd;
+			continue;
+		}
+
+		// Cull subtrees outside of view, children are contained in parent
+		const float sampleX1 = rect.x + (float)((sample.startTime - viewStart).count() * pixelsPerTick);
+		const float sampleX2 = sampleX1 + (float)(sample.duration.count() * pixelsPerTick);
+		if (sampleX2 < rect.x1 || sampleX1 > rect.x2)
+		{
+			index = subtreeEnd;
+			continue;
+		}
+
+		Row& row = rows[lane.firstRow + depth];
+		const float y = row.y;
+		const float x1 = math::max(sampleX1, rect.x1);
+		const float width = math::min(sampleX2, rect.x2) - x1;
+		const Profiler::CategoryInfo* category = sample.info->category.get();
+
+		if (width < kMinSampleWidth)
 		{
-			while (childCountStack.size() > 0 && --childCountStack.back() == 0)
+			// Merge into block, children are covered by it as well
+			//	Thread lanes are not drawn in time order across frames, so the block can grow either way
+			MergedBlock& block = row.pendingBlock;
+			if (block.sampleCount > 0 && x1 <= block.x2 + kMergeGap && x1 + width >= block.x1 - kMergeGap)
 			{
-				childCountStack.pop_back();
+				block.x1 = math::min(block.x1, x1);
+				block.x2 = math::max(block.x2, x1 + width);
+				if (block.category != category)
+					block.category = nullptr;
+				++block.sampleCount;
 			}
+			else
+			{
+				flushMergedBlock(gui, row);
+				block = MergedBlock{ x1, x1 + width, 1, category };
+			}
+
+			index = subtreeEnd;
+			continue;
 		}
+
+		flushMergedBlock(gui, row);
+
+		if (row.primitiveCount < kMaxPrimitivesPerRow)
+		{
+			const Rect2 sampleRect = Rect2(x1, y, width, kRowHeight);
+			gui->filledRect(sampleRect, category->color);
+			++row.primitiveCount;
+
+			const Profiler::SampleInfo* sampleInfo = sample.info.get();
+			auto labelWidthIt = m_state->labelWidths.find(sampleInfo);
+			if (labelWidthIt == m_state->labelWidths.end())
+				labelWidthIt = m_state->labelWidths.emplace(sampleInfo, gui->textWidth(sampleInfo->name)).first;
+
+			if (width >= labelWidthIt->second + kLabelPadding * 2 && row.primitiveCount < kMaxPrimitivesPerRow)
+			{
+				gui->text(sampleRect, sampleInfo->name, Color32(0,0,0,1));
+				++row.primitiveCount;
+			}
+		}
+
+		subtreeEndStack.push_back(subtreeEnd);
+		++index;
 	}
-	ASSERT(childCountStack.size() == 0);
 }
 
 }
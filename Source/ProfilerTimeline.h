@@ -1,9 +1,19 @@
+#pragma once
+
 #include "Core.h"
 
 namespace jcpe
 {
 
 class IMGui;
+namespace Profiler
+{
+	struct Sample;
+}
+namespace profilerTimeline
+{
+	struct Lane;
+}
 
 class ProfilerTimeline
 {
@@ -11,12 +21,27 @@ public:
 	static unique_ptr<ProfilerTimeline> create();
 	~ProfilerTimeline();
 
-	void draw(not_null<IMGui*> gui);
+	// Scroll to zoom, drag to pan, click a frame in the strip to inspect it, right click to go back live
+	//	Call every frame the timeline is shown, whether it is drawn again or not
+	void update(not_null<IMGui*> gui, const Rect2& area);
+	// Shows profiler history on a zoomable timeline, with a frame time strip on top, as of the last update
+	void draw(not_null<IMGui*> gui, const Rect2& area);
+
+	// Live timelines show each new frame, paused ones only change with their view
+	bool isLive() const;
+	// Changes with anything draw shows other than profiler history
+	uint64 getViewHash() const;
 
 private:
 	struct State;	
 	ProfilerTimeline(State* state);
 
+	void handleInput(not_null<IMGui*> gui, const Rect2& stripRect, const Rect2& timelineRect);
+	void drawFrameStrip(not_null<IMGui*> gui, const Rect2& rect);
+	void drawTimeline(not_null<IMGui*> gui, const Rect2& rect);
+	void drawFrameSamples(not_null<IMGui*> gui, const vector<Profiler::Sample>& samples, 
+			const profilerTimeline::Lane& lane, const Rect2& rect);
+
 	State* m_state;
 };
 
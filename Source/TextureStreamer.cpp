@@ -0,0 +1,195 @@
+#include "TextureStreamer.h"
+
+#include <condition_variable>
+#include <mutex>
+
+#include "ColorDefines.h"
+#include "Jobs.h"
+#include "Profiler.h"
+
+namespace jcpe
+{
+
+const auto kProfilerCategoryTextureStreaming = Profiler::CategoryInfo { "TextureStreaming", Color::kTeal };
+
+namespace textureStreamer
+{
+	// Bounds GPU copies started per update, so a burst of requests is spread over frames
+	static const uint kMaxUploadBytesPerUpdate = 16 * 1024 * 1024;
+
+	enum class RequestState
+	{
+		Decoding = 0,
+		Uploading,
+		Ready
+	};
+
+	struct Request
+	{
+		uint id;
+		Graphics::TextureCreationParams params;
+		owned_ptr<Graphics::TextureUpload> upload;
+		Graphics::TextureHandle texture = Graphics::TextureHandle(0);
+		RequestState state = RequestState::Decoding;
+		// Set by the decoding worker, guarded by state mutex
+		bool decoded = false;
+	};
+}
+
+struct TextureStreamer::State
+{
+	WorkerPool* workers;
+	// Requests are referenced by their decode jobs, so they stay put while decoding
+	vector<unique_ptr<textureStreamer::Request>> requests;
+	uint nextId = 1;
+
+	std::mutex mutex;
+	std::condition_variable decodedCondition;
+	uint decodingCount = 0;
+
+	textureStreamer::Request* findRequest(TextureStreamHandle handle) const
+	{
+		for (auto& request : requests)
+		{
+			if (request->id == handle)
+				return request.get();
+		}
+		return nullptr;
+	}
+};
+
+unique_ptr<TextureStreamer> TextureStreamer::create(not_null<WorkerPool*> workers)
+{
+	void* const baseAddr = malloc(sizeof(TextureStreamer) + sizeof(State));
+	void* const stateAddr = (void*)((uint8*)baseAddr + sizeof(TextureStreamer));
+
+	auto* state = new (stateAddr) State();
+	auto* obj = new (baseAddr) TextureStreamer(state);
+
+	state->workers = workers;
+	return unique_ptr<TextureStreamer>(obj);
+}
+
+TextureStreamer::TextureStreamer(State* state)
+	: m_state(state)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	State& state = *m_state;
+	{
+		std::unique_lock<std::mutex> lock(state.mutex);
+		state.decodedCondition.wait(lock, [&]() { return state.decodingCount == 0; });
+	}
+
+	for (auto& request : state.requests)
+	{
+		if (request->upload)
+			Graphics::destroyTextureUpload(std::move(request->upload));
+		if (request->texture != 0)
+			Graphics::destroyTexture(request->texture);
+	}
+
+	m_state->~State();
+}
+
+TextureStreamHandle TextureStreamer::request(const Graphics::TextureCreationParams& params, const Decoder& decoder)
+{
+	using namespace textureStreamer;
+	State& state = *m_state;
+
+	state.requests.push_back(make_unique<Request>());
+	Request* const request = state.requests.back().get();
+	request->id = state.nextId++;
+	request->params = params;
+	request->upload = Graphics::beginTextureUpload(params);
+
+	void* const pixels = Graphics::getTextureUploadData(request->upload.get()).get();
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		++state.decodingCount;
+	}
+
+	State* const statePtr = m_state;
+	state.workers->enqueueBackground([statePtr, request, pixels, decoder]()
+		{
+			{
+				PROFILER_SCOPE("DecodeTexture", &kProfilerCategoryTextureStreaming);
+				decoder(pixels);
+			}
+
+			std::lock_guard<std::mutex> lock(statePtr->mutex);
+			request->decoded = true;
+			--statePtr->decodingCount;
+			statePtr->decodedCondition.notify_all();
+		});
+
+	return TextureStreamHandle(request->id);
+}
+
+void TextureStreamer::update()
+{
+	PROFILER_SCOPE("TextureStreamerUpdate", &kProfilerCategoryTextureStreaming);
+
+	using namespace textureStreamer;
+	State& state = *m_state;
+
+	uint uploadBytes = 0;
+	uint readyCount = 0;
+	for (auto& requestPtr : state.requests)
+	{
+		Request& request = *requestPtr;
+		if (request.state == RequestState::Decoding)
+		{
+			const uint size = Graphics::getTextureDataSize(request.params);
+			if (uploadBytes > 0 && uploadBytes + size > kMaxUploadBytesPerUpdate)
+				continue;
+
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (!request.decoded)
+					continue;
+			}
+
+			request.texture = Graphics::endTextureUpload(request.upload.get());
+			request.state = RequestState::Uploading;
+			uploadBytes += size;
+		}
+		else if (request.state == RequestState::Uploading && Graphics::isTextureUploadComplete(request.upload.get()))
+		{
+			Graphics::destroyTextureUpload(std::move(request.upload));
+			request.state = RequestState::Ready;
+			++readyCount;
+		}
+	}
+
+	PROFILER_COUNTER_ADD("TexturesStreamed", readyCount);
+}
+
+bool TextureStreamer::isReady(TextureStreamHandle handle) const
+{
+	const textureStreamer::Request* request = m_state->findRequest(handle);
+	FATAL_ASSERT_DESC(request, "Unknown texture stream handle");
+	return request->state == textureStreamer::RequestState::Ready;
+}
+
+Graphics::TextureHandle TextureStreamer::takeTexture(TextureStreamHandle handle)
+{
+	State& state = *m_state;
+	textureStreamer::Request* request = state.findRequest(handle);
+	FATAL_ASSERT_DESC(request && request->state == textureStreamer::RequestState::Ready, "Only ready textures can be taken");
+
+	const Graphics::TextureHandle texture = request->texture;
+	for (auto it = state.requests.begin(); it != state.requests.end(); ++it)
+	{
+		if (it->get() == request)
+		{
+			state.requests.erase(it);
+			break;
+		}
+	}
+	return texture;
+}
+
+}
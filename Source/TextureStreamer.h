@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Core.h"
+#include "Graphics.h"
+
+#include <functional>
+
+namespace jcpe
+{
+
+class WorkerPool;
+
+using TextureStreamHandle = TypeWrapper<uint>;
+
+// Loads textures without stalling the frame
+//	Pixels are decoded on background workers straight into mapped pixel buffers, the GPU copies them into textures,
+//	and a texture is ready in a later frame, once that copy is done
+class TextureStreamer
+{
+public:
+	// Writes getTextureDataSize(params) bytes of tightly packed pixels, called on a worker
+	using Decoder = std::function<void(void* pixels)>;
+
+	// Pool has to outlive the streamer
+	static unique_ptr<TextureStreamer> create(not_null<WorkerPool*> workers);
+	// Waits for decodes in flight, textures not taken are destroyed
+	//	Deadlocks if the pool has dropped a queued decode, which it does when destroyed first
+	~TextureStreamer();
+
+	// All functions are context thread only
+	TextureStreamHandle request(const Graphics::TextureCreationParams& params, const Decoder& decoder);
+	// Call once per frame, starts GPU copies of decoded pixels and marks textures whose copy is done as ready
+	void update();
+
+	bool isReady(TextureStreamHandle handle) const;
+	// Ready textures only, caller owns the texture afterwards and the handle is released
+	Graphics::TextureHandle takeTexture(TextureStreamHandle handle);
+
+private:
+	struct State;	
+	TextureStreamer(State* state);
+
+	State* m_state;
+};
+
+}
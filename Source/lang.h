@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cassert>
+#include <cstring>
 #include <memory>
+#include <string>
 #include <vector>
 #include <stdint.h>
 
@@ -14,6 +16,7 @@
 #include "gsl/gsl"
 
 // TODO: Move out to math lib
+#include "glm/gtc/constants.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/norm.hpp"
 
@@ -92,6 +95,36 @@ namespace lang
 	using gsl::span;
 	using gsl::not_null;
 
+	// Non-owning view of characters, stand-in until C++17 std::string_view
+	class string_view
+	{
+	public:
+		constexpr string_view() : m_data(nullptr), m_size(0) {}
+		constexpr string_view(const char* data, size_t size) : m_data(data), m_size(size) {}
+		string_view(const char* str) : m_data(str), m_size(strlen(str)) {}
+		string_view(const string& str) : m_data(str.data()), m_size(str.size()) {}
+
+		constexpr const char* data() const { return m_data; }
+		constexpr size_t size() const { return m_size; }
+		constexpr size_t length() const { return m_size; }
+		constexpr bool empty() const { return m_size == 0; }
+		constexpr const char* begin() const { return m_data; }
+		constexpr const char* end() const { return m_data + m_size; }
+		constexpr char operator[](size_t index) const { return m_data[index]; }
+
+		string to_string() const { return string(m_data, m_size); }
+
+		bool operator==(const string_view& other) const
+		{
+			return m_size == other.m_size && (m_size == 0 || memcmp(m_data, other.m_data, m_size) == 0);
+		}
+		bool operator!=(const string_view& other) const { return !(*this == other); }
+
+	private:
+		const char* m_data;
+		size_t m_size;
+	};
+
 	#define array_size(a) ((sizeof(a) / sizeof(*(a))) / static_cast<size_t>(!(sizeof(a) % sizeof(*(a)))))
 
 	template <typename T, class Deleter = std::default_delete<T>>
@@ -1,7 +1,10 @@
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <cxxabi.h>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
@@ -15,8 +18,12 @@
 #include "ColorDefines.h"
 #include "Profiler.h"
 #include "ProfilerTimeline.h"
+#include "FrameTimeGraph.h"
+#include "ProfilerFlameGraph.h"
 
 #include "IMGui.h"
+#include "Jobs.h"
+#include "TextureStreamer.h"
 
 
 namespace jcpe
@@ -32,9 +39,46 @@ const auto kProfilerCategoryDrawing = Profiler::CategoryInfo { "Drawing", Color:
 const auto kProfilerCategoryRendering = Profiler::CategoryInfo { "Rendering", Color::kOrange };
 
 static owned_ptr<Graphics::Window> s_window;
+static unique_ptr<WorkerPool> s_workers;
 static unique_ptr<IMGui> s_imGui;
 
 static unique_ptr<ProfilerTimeline> s_profilerTimeline;
+static unique_ptr<FrameTimeGraph> s_frameTimeGraph;
+static unique_ptr<ProfilerFlameGraph> s_profilerFlameGraph;
+static bool s_showProfilerTimeline = true;
+static bool s_showFrameTimeGraph = true;
+static bool s_showProfilerFlameGraph = false;
+static IMGuiBackend s_primitiveBackend = IMGuiBackend::Native;
+// Builds and renders the UI on a thread of its own, while the next frame simulates
+static bool s_renderThreadEnabled = false;
+// Streams textures in the window instead of running the game, reports how long they take to be ready
+static bool s_textureStreamBenchmarkEnabled = false;
+
+// Everything the profiler layer shows depends on, it is only recorded again when this changes
+struct ProfilerLayerKey
+{
+	vec2 canvasSize;
+	IMGuiBackend primitiveBackend;
+	bool showProfilerTimeline;
+	bool showFrameTimeGraph;
+	bool showProfilerFlameGraph;
+	// Zero while the timeline is hidden
+	uint64 timelineViewHash;
+	// Zero unless a shown view follows the newest frame, the graphs always do and the timeline while live
+	uint64 profilerFrameCount;
+
+	bool operator==(const ProfilerLayerKey& other) const
+	{
+		return canvasSize == other.canvasSize && primitiveBackend == other.primitiveBackend && 
+				showProfilerTimeline == other.showProfilerTimeline && showFrameTimeGraph == other.showFrameTimeGraph && 
+				showProfilerFlameGraph == other.showProfilerFlameGraph && timelineViewHash == other.timelineViewHash && 
+				profilerFrameCount == other.profilerFrameCount;
+	}
+};
+
+// Only touched by the thread drawing frames
+static bool s_profilerLayerRecorded = false;
+static ProfilerLayerKey s_profilerLayerKey;
 
 
 const float s_frameDelayMs = 16;
@@ -159,19 +203,168 @@ void simulateBalls(const vec2& canvasSize)
 	}
 }
 
-void drawBalls()
+// Everything the UI of a frame is built from, copied so the next frame can simulate meanwhile
+struct FramePacket
 {
-	PROFILER_SCOPE("Draw balls", &kProfilerCategoryDrawing);
+	vec2 canvasSize;
+	// Polled on the main thread, fed to the UI with the frame
+	vector<SDL_Event> events;
+	// Recorded on the main thread, replayed beneath the UI by whichever thread renders the frame
+	owned_ptr<Graphics::CommandBuffer> ballCommands;
+	bool showProfilerTimeline;
+	bool showFrameTimeGraph;
+	bool showProfilerFlameGraph;
+	IMGuiBackend primitiveBackend;
+};
 
-	for (auto& b : s_balls)
+// Owns the GL context while running, and builds and renders the UI of submitted frames
+//	Packets are double buffered, packet of frame N + 2 is only filled once frame N is rendered
+struct RenderThread
+{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	FramePacket packets[2];
+	// Frame packets submitted and rendered so far, frame i uses packet i % 2
+	uint64 submittedCount = 0;
+	uint64 renderedCount = 0;
+	bool quit = false;
+};
+
+static const char* s_ballVertexSource = R"(
+	#version 150
+	uniform mat4 mvp;
+	in vec2 corner;
+	in vec3 centerRadius;
+	in vec4 color;
+	out vec2 fragOffset;
+	out float fragRadius;
+	out vec4 fragColor;
+	void main()
+	{
+		// Pad quad so anti-aliased edge is not cut off
+		fragOffset = corner * (centerRadius.z + 1.0);
+		fragRadius = centerRadius.z;
+		fragColor = color;
+		gl_Position = mvp * vec4(centerRadius.xy + fragOffset, 0.0, 1.0);
+	}
+	)";
+
+static const char* s_ballFragmentSource = R"(
+	#version 150
+	in vec2 fragOffset;
+	in float fragRadius;
+	in vec4 fragColor;
+	out vec4 outColor;
+	void main()
+	{
+		float dist = length(fragOffset) - fragRadius;
+		float coverage = clamp(0.5 - dist / fwidth(dist), 0.0, 1.0);
+		outColor = vec4(fragColor.rgb, fragColor.a * coverage);
+	}
+	)";
+
+static const float s_ballCorners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+struct BallInstance
+{
+	float centerRadius[3];
+	uint8 color[4];
+};
+
+// Created before the render thread starts, so the main thread can record with them
+struct BallRenderResources
+{
+	owned_ptr<Graphics::Program> program;
+	Graphics::UniformHandle mvpUniform;
+	Graphics::AttributeHandle cornerAttribute;
+	Graphics::AttributeHandle centerRadiusAttribute;
+	Graphics::AttributeHandle colorAttribute;
+	Graphics::BufferHandle cornerBuffer;
+	owned_ptr<Graphics::StreamBuffer> instanceStream;
+	Graphics::AttributeBindingsHandle attributeBindings;
+};
+
+static BallRenderResources s_ballResources;
+static vector<BallInstance> s_ballInstances;
+
+// Has to be called on the thread owning the GL context
+bool createBallRenderResources()
+{
+	using namespace Graphics;
+	BallRenderResources& resources = s_ballResources;
+
+	ProgramCreationParams programParams = { s_ballVertexSource, s_ballFragmentSource };
+	resources.program = createProgram(programParams);
+	if (!resources.program)
+		return false;
+	resources.mvpUniform = fetchUniformHandle(resources.program, "mvp");
+	resources.cornerAttribute = fetchAttributeHandle(resources.program, "corner");
+	resources.centerRadiusAttribute = fetchAttributeHandle(resources.program, "centerRadius");
+	resources.colorAttribute = fetchAttributeHandle(resources.program, "color");
+
+	resources.cornerBuffer = createBuffer();
+	uploadStaticVertexBufferData(resources.cornerBuffer, s_ballCorners, sizeof(s_ballCorners));
+
+	// Room for the balls of every frame that may be in flight, grows if more are added
+	const uint framesInFlight = 3;
+	resources.instanceStream = createStreamBuffer(BufferTarget::Vertex, 
+			s_ballCountX * s_ballCountY * sizeof(BallInstance) * framesInFlight);
+	resources.attributeBindings = createAttributeBindings();
+	return true;
+}
+
+void destroyBallRenderResources()
+{
+	using namespace Graphics;
+	BallRenderResources& resources = s_ballResources;
+	destroyAttributeBindings(resources.attributeBindings);
+	destroyStreamBuffer(std::move(resources.instanceStream));
+	destroyBuffer(resources.cornerBuffer);
+	destroyProgram(std::move(resources.program));
+}
+
+// Touches no GL state, replaying the commands uploads the instances and draws them
+void recordBalls(not_null<Graphics::CommandBuffer*> commandBuffer, const vector<Ball>& balls, const vec2& canvasSize)
+{
+	PROFILER_SCOPE("Record balls", &kProfilerCategoryDrawing);
+
+	using namespace Graphics;
+	const BallRenderResources& resources = s_ballResources;
+
+	resetCommandBuffer(commandBuffer);
+	if (balls.empty())
+		return;
+
+	s_ballInstances.clear();
+	for (auto& b : balls)
 	{
-		s_imGui->filledCircle(Rect2(Point2(b.pos.x - b.radius, b.pos.y - b.radius), vec2(b.radius * 2, b.radius * 2)), b.color);
+		const auto c = b.color.bytes();
+		s_ballInstances.push_back({ { b.pos.x, b.pos.y, b.radius }, { c.x, c.y, c.z, c.w } });
 	}
+
+	const uint instanceSize = sizeof(BallInstance);
+	recordSetBlendMode(commandBuffer, BlendMode::AlphaBlend);
+	recordSetDepthTestMode(commandBuffer, DepthTestMode::Disabled);
+	recordBindProgram(commandBuffer, resources.program.get());
+	recordSetUniform(commandBuffer, resources.mvpUniform, math::ortho(0.0f, canvasSize.x, canvasSize.y, 0.0f));
+	recordUploadStreamBufferData(commandBuffer, resources.instanceStream.get(), s_ballInstances.data(), 
+			s_ballInstances.size() * instanceSize, instanceSize);
+
+	// No base instance in GL 3.3, instance attributes source the upload directly and move with it on every replay
+	const AttributeBindingInfo attributeInfos[] = {
+			{ resources.cornerAttribute, resources.cornerBuffer, AttributeType::Float, 2, sizeof(float) * 2, 0, 0 },
+			{ resources.centerRadiusAttribute, BufferHandle(0), AttributeType::Float, 3, instanceSize, offsetof(BallInstance, centerRadius), 1 },
+			{ resources.colorAttribute, BufferHandle(0), AttributeType::NormalizedUInt8, 4, instanceSize, offsetof(BallInstance, color), 1 }};
+	recordStoreAttributeBindings(commandBuffer, resources.attributeBindings, attributeInfos);
+	recordBindAttributes(commandBuffer, resources.attributeBindings);
+	recordDrawInstanced(commandBuffer, PrimitiveType::TriangleStrip, 4, s_ballInstances.size());
 }
 
-void render()
+void render(const FramePacket& packet)
 {
 	PROFILER_SCOPE("Render", &kProfilerCategoryRendering);
+	GPU_PROFILER_SCOPE("Render", &kProfilerCategoryRendering);
 
 	using namespace Graphics;
 
@@ -180,26 +373,59 @@ void render()
 	setClearColor(Color32(1.0f, 1.0f, 1.0f, 1.0f));
 	clearFrameBuffer();
 
+	executeCommandBuffer(packet.ballCommands.get());
+
 	s_imGui->render(s_window);
 }
 
-bool mainloop()
+// Has to be called on the thread owning the GL context
+void createRenderResources()
 {
-	PROFILER_SCOPE("Mainloop");
+	s_imGui = make_unique<IMGui>();
+	s_imGui->setPrimitiveBackend(s_primitiveBackend);
+	s_profilerLayerRecorded = false;
+	s_imGui->setTessellationWorkers(s_workers);
 
-	++s_frame;
+	s_profilerTimeline = ProfilerTimeline::create();
+	s_frameTimeGraph = FrameTimeGraph::create();
+	s_profilerFlameGraph = ProfilerFlameGraph::create();
+}
 
+void destroyRenderResources()
+{
+	s_profilerFlameGraph.reset();
+	s_frameTimeGraph.reset();
+	s_profilerTimeline.reset();
+	s_imGui.reset();
+}
+
+// Returns true when quitting
+bool pollInput(not_null<FramePacket*> packet)
+{
 	bool done = false;
 	SDL_Event event;
+	packet->events.clear();
 	while(SDL_PollEvent(&event))
 	{
+		packet->events.push_back(event);
+
 		switch (event.type)
 		{
 			case SDL_QUIT: done = true; break;
 			case SDL_KEYDOWN:
 			{
-				if (event.key.state == SDL_PRESSED && event.key.keysym.sym == SDLK_ESCAPE)
+				if (event.key.state != SDL_PRESSED)
+					break;
+				if (event.key.keysym.sym == SDLK_ESCAPE)
 					done = true;
+				else if (event.key.keysym.sym == SDLK_F1)
+					s_showProfilerTimeline = !s_showProfilerTimeline;
+				else if (event.key.keysym.sym == SDLK_F2)
+					s_showFrameTimeGraph = !s_showFrameTimeGraph;
+				else if (event.key.keysym.sym == SDLK_F3)
+					s_showProfilerFlameGraph = !s_showProfilerFlameGraph;
+				else if (event.key.keysym.sym == SDLK_F4)
+					s_primitiveBackend = s_primitiveBackend == IMGuiBackend::Native ? IMGuiBackend::Nuklear : IMGuiBackend::Native;
 				break;
 			}
 			case SDL_WINDOWEVENT:
@@ -214,14 +440,88 @@ bool mainloop()
 		}
 	}
 
+	return done;
+}
+
+// Simulates a frame and fills in its packet, returns true when quitting
+bool mainloop(not_null<FramePacket*> packet)
+{
+	PROFILER_SCOPE("Mainloop");
+
+	++s_frame;
+
+	const bool done = pollInput(packet);
+
 	const vec2 canvasize = Graphics::getWindowCanvasSize(s_window);
-	s_imGui->beginFrame(vec2(canvasize.x, canvasize.y));
 
 	if (!s_ballSetup)
 		setupBalls(canvasize);
 
 	simulateBalls(canvasize);
-	drawBalls();
+
+	packet->canvasSize = canvasize;
+	recordBalls(packet->ballCommands.get(), s_balls, canvasize);
+	packet->showProfilerTimeline = s_showProfilerTimeline;
+	packet->showFrameTimeGraph = s_showFrameTimeGraph;
+	packet->showProfilerFlameGraph = s_showProfilerFlameGraph;
+	packet->primitiveBackend = s_primitiveBackend;
+
+	return done;
+}
+
+// Records profiler views into their layer if they changed since it was last recorded, profiler history has to be locked
+void drawProfilerLayer(const FramePacket& packet)
+{
+	// Input is handled every frame, so a retained timeline still zooms, pans and resumes
+	const vec2& canvasize = packet.canvasSize;
+	const Rect2 timelineArea = Rect2(Point2(0, 0), canvasize);
+	if (packet.showProfilerTimeline)
+		s_profilerTimeline->update(s_imGui, timelineArea);
+
+	const bool followsNewestFrame = (packet.showProfilerTimeline && s_profilerTimeline->isLive()) || 
+			packet.showFrameTimeGraph || packet.showProfilerFlameGraph;
+	const ProfilerLayerKey key = { packet.canvasSize, packet.primitiveBackend, packet.showProfilerTimeline, 
+			packet.showFrameTimeGraph, packet.showProfilerFlameGraph, 
+			packet.showProfilerTimeline ? s_profilerTimeline->getViewHash() : 0, 
+			followsNewestFrame ? Profiler::getProfiler()->getFrameCount() : 0 };
+	if (s_profilerLayerRecorded && key == s_profilerLayerKey)
+		return;
+	s_profilerLayerRecorded = true;
+	s_profilerLayerKey = key;
+
+	// Profiler views go above the balls, in a layer of their own
+	s_imGui->beginLayer("Profiler", 1);
+
+	if (packet.showProfilerTimeline)
+		s_profilerTimeline->draw(s_imGui, timelineArea);
+
+	const vec2 graphSize = vec2(320, 120);
+	if (packet.showFrameTimeGraph)
+		s_frameTimeGraph->draw(s_imGui, Rect2(Point2(canvasize.x - graphSize.x, canvasize.y - graphSize.y), graphSize));
+
+	if (packet.showProfilerFlameGraph)
+	{
+		const float flameGraphHeight = 160;
+		s_profilerFlameGraph->draw(s_imGui, Rect2(0, canvasize.y - flameGraphHeight, canvasize.x - graphSize.x, flameGraphHeight));
+	}
+
+	s_imGui->endLayer();
+}
+
+// Builds and renders the UI of a frame, on the thread owning the GL context
+void drawFrame(const FramePacket& packet)
+{
+	PROFILER_SCOPE("DrawFrame");
+
+	s_imGui->beginInput();
+	for (const SDL_Event& event : packet.events)
+		s_imGui->processEvent(event);
+	s_imGui->endInput();
+
+	s_imGui->setPrimitiveBackend(packet.primitiveBackend);
+
+	const vec2& canvasize = packet.canvasSize;
+	s_imGui->beginFrame(vec2(canvasize.x, canvasize.y));
 
 	//s_imGui->filledCircle(Rect2(Point2(50, 50), vec2(25, 25)), Color::red);
 
@@ -229,16 +529,222 @@ bool mainloop()
 
 	//s_imGui->text(Rect2(Point2(150, 150), vec2(25, 25)), "Testing text", Color::blue);
 
-	s_profilerTimeline->draw(s_imGui);
+	{
+		// Main thread may be ending a frame meanwhile, when rendering on a thread of its own
+		auto historyLock = Profiler::getProfiler()->lockHistory();
+		drawProfilerLayer(packet);
+	}
 
 	s_imGui->endFrame();
 
-	render();
+	render(packet);
+}
 
-	return done;
+void renderThreadMain(RenderThread* renderThread, Graphics::Context* context)
+{
+	Profiler::getProfiler()->registerThread("Render");
+
+	Graphics::makeContextCurrent(s_window, context);
+	createRenderResources();
+
+	while (true)
+	{
+		{
+			PROFILER_SCOPE("WaitingForPacket", &Profiler::kProfilerCategoryIdle);
+			std::unique_lock<std::mutex> lock(renderThread->mutex);
+			renderThread->condition.wait(lock, [renderThread]() { 
+					return renderThread->quit || renderThread->renderedCount < renderThread->submittedCount; });
+			if (renderThread->renderedCount == renderThread->submittedCount)
+				break;
+		}
+
+		// Main thread leaves submitted packets alone until they are rendered
+		drawFrame(renderThread->packets[renderThread->renderedCount % 2]);
+		Graphics::swapWindow(s_window);
+
+		{
+			std::lock_guard<std::mutex> lock(renderThread->mutex);
+			++renderThread->renderedCount;
+		}
+		renderThread->condition.notify_all();
+	}
+
+	destroyRenderResources();
+	Graphics::releaseContextCurrent(s_window);
+}
+
+void runSingleThreaded()
+{
+	createRenderResources();
+
+	// End initialization frame
+	Profiler::getProfiler()->endFrame();
+
+	FramePacket packet;
+	packet.ballCommands = Graphics::createCommandBuffer();
+	SCOPE_EXIT( Graphics::destroyCommandBuffer(std::move(packet.ballCommands)); );
+
+	bool done = false;
+	while (!done)
+	{	
+		Profiler::getProfiler()->beginFrame();
+
+		done = mainloop(&packet);
+		drawFrame(packet);
+		Graphics::swapWindow(s_window);
+
+		{
+			PROFILER_SCOPE("WaitingForFrame", &Profiler::kProfilerCategoryIdle);
+			SDL_Delay(s_frameDelayMs);
+		}
+
+		Profiler::getProfiler()->endFrame();
+	}
+
+	destroyRenderResources();
+}
+
+// Frame N renders on the render thread while frame N + 1 simulates, context is current again on return
+void runWithRenderThread(not_null<Graphics::Context*> context)
+{
+	RenderThread renderThread;
+	for (FramePacket& packet : renderThread.packets)
+		packet.ballCommands = Graphics::createCommandBuffer();
+
+	Graphics::releaseContextCurrent(s_window);
+	renderThread.thread = std::thread(&renderThreadMain, &renderThread, context.get());
+
+	// End initialization frame
+	Profiler::getProfiler()->endFrame();
+
+	bool done = false;
+	while (!done)
+	{	
+		Profiler::getProfiler()->beginFrame();
+
+		// Packet is free once the frame before last has been rendered, bounding latency to one frame
+		{
+			PROFILER_SCOPE("WaitingForRenderThread", &Profiler::kProfilerCategoryIdle);
+			std::unique_lock<std::mutex> lock(renderThread.mutex);
+			renderThread.condition.wait(lock, [&renderThread]() { 
+					return renderThread.submittedCount - renderThread.renderedCount < array_size(renderThread.packets); });
+		}
+
+		done = mainloop(&renderThread.packets[renderThread.submittedCount % 2]);
+
+		{
+			std::lock_guard<std::mutex> lock(renderThread.mutex);
+			++renderThread.submittedCount;
+		}
+		renderThread.condition.notify_all();
+
+		{
+			PROFILER_SCOPE("WaitingForFrame", &Profiler::kProfilerCategoryIdle);
+			SDL_Delay(s_frameDelayMs);
+		}
+
+		Profiler::getProfiler()->endFrame();
+	}
+
+	// Rendering submitted frames finishes before quitting
+	{
+		std::lock_guard<std::mutex> lock(renderThread.mutex);
+		renderThread.quit = true;
+	}
+	renderThread.condition.notify_all();
+	renderThread.thread.join();
+
+	for (FramePacket& packet : renderThread.packets)
+		Graphics::destroyCommandBuffer(std::move(packet.ballCommands));
+
+	Graphics::makeContextCurrent(s_window, context);
+}
+
+// Streams batches of textures of each format with and without mipmaps, needs the window's context for uploads
+int runTextureStreamBenchmark()
+{
+	const uint textureCount = 32;
+	const uint textureSize = 512;
+	const uint maxFrameCount = 1000;
+
+	// End initialization frame
+	Profiler::getProfiler()->endFrame();
+
+	struct BenchmarkConfig
+	{
+		const char* name;
+		Graphics::TextureFormat format;
+		bool mipmaps;
+	};
+
+	const BenchmarkConfig configs[] = {
+			{ "R8", Graphics::TextureFormat::R8, false },
+			{ "R8 mipmapped", Graphics::TextureFormat::R8, true },
+			{ "RG8", Graphics::TextureFormat::RG8, false },
+			{ "RG8 mipmapped", Graphics::TextureFormat::RG8, true },
+			{ "RGBA8", Graphics::TextureFormat::RGBA8, false },
+			{ "RGBA8 mipmapped", Graphics::TextureFormat::RGBA8, true }};
+
+	unique_ptr<TextureStreamer> streamer = TextureStreamer::create(s_workers);
+	bool passed = true;
+	for (uint i = 0; i < array_size(configs); ++i)
+	{
+		const Graphics::TextureCreationParams params = { textureSize, textureSize, configs[i].format, configs[i].mipmaps };
+		const uint dataSize = Graphics::getTextureDataSize(params);
+
+		const auto startTime = Profiler::getTime();
+		vector<TextureStreamHandle> handles;
+		for (uint texture = 0; texture < textureCount; ++texture)
+		{
+			// Stands in for decoding a file, pattern differs per texture
+			handles.push_back(streamer->request(params, [dataSize, texture](void* pixels)
+				{
+					uint8* const bytes = (uint8*)pixels;
+					for (uint b = 0; b < dataSize; ++b)
+						bytes[b] = (uint8)(b * 31 + texture);
+				}));
+		}
+
+		uint frameCount = 0;
+		uint readyCount = 0;
+		while (readyCount < textureCount && frameCount < maxFrameCount)
+		{
+			Profiler::getProfiler()->beginFrame();
+			++s_frame;
+
+			SDL_PumpEvents();
+			streamer->update();
+			Graphics::swapWindow(s_window);
+
+			readyCount = 0;
+			for (TextureStreamHandle handle : handles)
+				readyCount += streamer->isReady(handle) ? 1 : 0;
+			++frameCount;
+
+			Profiler::getProfiler()->endFrame();
+		}
+		const float totalMs = std::chrono::duration<float, std::milli>(Profiler::getTime() - startTime).count();
+
+		for (TextureStreamHandle handle : handles)
+		{
+			if (streamer->isReady(handle))
+				Graphics::destroyTexture(streamer->takeTexture(handle));
+		}
+
+		LOG(configs[i].name << ": " << readyCount << " of " << textureCount << " textures ready after " << frameCount << " frames, " 
+				<< totalMs << " ms, " << (textureCount * dataSize / (1024.0f * 1024.0f)) / (totalMs / 1000.0f) << " MB/s");
+		if (readyCount < textureCount)
+		{
+			LOG(configs[i].name << ": textures not ready within " << maxFrameCount << " frames");
+			passed = false;
+		}
+	}
+
+	return passed ? 0 : 1;
 }
 
 int run()
+
 {
 	// Begin initialization frame
 	Profiler::getProfiler()->beginFrame();
@@ -291,28 +797,22 @@ int run()
 
 	SCOPE_EXIT( Graphics::destroyProgram(std::move(program)); );
 
-	s_imGui = make_unique<IMGui>();
+	// Workers hold registered profiler threads, so they have to go before the profiler does
+	s_workers = WorkerPool::create();
+	SCOPE_EXIT( s_workers.reset(); );
 
-	s_profilerTimeline = ProfilerTimeline::create();
+	if (s_textureStreamBenchmarkEnabled)
+		return runTextureStreamBenchmark();
 
-	// End initialization frame
-	Profiler::getProfiler()->endFrame();
+	if (!createBallRenderResources())
+		return 1;
 
-	bool done = false;
-	while (!done)
-	{	
-		Profiler::getProfiler()->beginFrame();
+	SCOPE_EXIT( destroyBallRenderResources(); );
 
-		done = mainloop();
-		Graphics::swapWindow(s_window);
-
-		{
-			PROFILER_SCOPE("WaitingForFrame", &Profiler::kProfilerCategoryIdle);
-			SDL_Delay(s_frameDelayMs);
-		}
-
-		Profiler::getProfiler()->endFrame();
-	}
+	if (s_renderThreadEnabled)
+		runWithRenderThread(context);
+	else
+		runSingleThreaded();
 
 	return 0;
 }
@@ -360,6 +860,132 @@ handler()
 	std::abort();
 }   
 
+void drawBenchmarkFrame(IMGui& gui, const vec2& canvasSize, uint frame)
+{
+	PROFILER_SCOPE("Draw benchmark frame", &kProfilerCategoryDrawing);
+
+	// Mix of every primitive, shifting each frame so geometry is never retained
+	const uint columnCount = 48;
+	const uint rowCount = 32;
+	const vec2 cellSize = vec2(canvasSize.x / columnCount, canvasSize.y / rowCount);
+	for (uint y = 0; y < rowCount; ++y)
+	{
+		for (uint x = 0; x < columnCount; ++x)
+		{
+			const Rect2 rect = Rect2(x * cellSize.x, y * cellSize.y, cellSize);
+			const Color32 color = Color32(x / (float)columnCount, y / (float)rowCount, (frame % 60) / 60.0f);
+			switch ((x + y + frame) % 4)
+			{
+				case 0: gui.filledRect(rect, color); break;
+				case 1: gui.filledCircle(rect, color); break;
+				case 2: gui.strokedCircle(rect, 2.0f, color); break;
+				default: gui.filledCircleBatched(rect.p1 + cellSize * 0.5f, cellSize.y * 0.5f, color); break;
+			}
+		}
+	}
+
+	for (uint y = 0; y < rowCount; ++y)
+	{
+		char label[64];
+		snprintf(label, array_size(label), "Row %u, frame %u", y, frame);
+		gui.text(Rect2(0, y * cellSize.y, 200.0f, cellSize.y), label, Color::kWhite);
+	}
+}
+
+struct BenchmarkFrameCounts
+{
+	uint vertexCount;
+	uint indexCount;
+};
+
+// Captured counts of the last benchmark frame, frame 499, in the native backend
+//	Each primitive type covers a quarter of the grid, circles of radius 13.3 get 17 segments
+//	Labels read "Row N, frame 499", 10 of 16 glyphs and 22 of 17 glyphs
+//	Batched circles take an unwritten vertex slot each, for their draw order
+static const uint kBenchmarkCellsPerType = 48 * 32 / 4;
+static const uint kBenchmarkGlyphCount = 10 * 16 + 22 * 17;
+static const BenchmarkFrameCounts kNativeBenchmarkFrameCounts = {
+		kBenchmarkCellsPerType * (4 + 18 + 17 * 2 + 1) + kBenchmarkGlyphCount * 4,
+		kBenchmarkCellsPerType * (6 + 17 * 3 + 17 * 6) + kBenchmarkGlyphCount * 6 };
+
+// Nuklear tessellation is its own, so only circles are counted exactly there
+static bool checkBenchmarkCapture(const char* name, const IMGuiCapture& capture, const BenchmarkFrameCounts* expected)
+{
+	bool passed = capture.circles.size() == kBenchmarkCellsPerType && capture.indices.size() % 3 == 0;
+	if (expected)
+		passed = passed && capture.vertices.size() == expected->vertexCount && capture.indices.size() == expected->indexCount;
+	for (uint index : capture.indices)
+		passed = passed && index < capture.vertices.size();
+
+	if (!passed)
+		LOG(name << ": unexpected capture of last frame");
+	return passed;
+}
+
+// Runs a synthetic UI through the capture output without a window, reports time per frame and output size
+//	Fails if the last frame does not capture the expected geometry
+int runIMGuiBenchmark()
+{
+	const uint frameCount = 500;
+	const vec2 canvasSize = vec2(1280, 720);
+
+	s_workers = WorkerPool::create();
+	SCOPE_EXIT( s_workers.reset(); );
+
+	IMGui gui(IMGuiOutput::Capture);
+	gui.setTessellationWorkers(s_workers);
+	IMGuiCapture capture;
+
+	struct BenchmarkConfig
+	{
+		const char* name;
+		IMGuiBackend backend;
+		IMGuiVertexFormat vertexFormat;
+		const BenchmarkFrameCounts* expectedCounts;
+	};
+
+	const BenchmarkConfig configs[] = {
+			{ "Nuklear", IMGuiBackend::Nuklear, IMGuiVertexFormat::Float, nullptr },
+			{ "Native", IMGuiBackend::Native, IMGuiVertexFormat::Float, &kNativeBenchmarkFrameCounts },
+			{ "Native compact", IMGuiBackend::Native, IMGuiVertexFormat::Compact, &kNativeBenchmarkFrameCounts }};
+	uint vertexDataSizes[array_size(configs)];
+	bool passed = true;
+	for (uint i = 0; i < array_size(configs); ++i)
+	{
+		gui.setPrimitiveBackend(configs[i].backend);
+		gui.setVertexFormat(configs[i].vertexFormat);
+
+		const auto startTime = Profiler::getTime();
+		for (uint frame = 0; frame < frameCount; ++frame)
+		{
+			Profiler::getProfiler()->beginFrame();
+			++s_frame;
+
+			gui.beginInput();
+			gui.endInput();
+			gui.beginFrame(canvasSize);
+			drawBenchmarkFrame(gui, canvasSize, frame);
+			gui.endFrame();
+			gui.capture(&capture, vec2i(canvasSize.x, canvasSize.y));
+
+			Profiler::getProfiler()->endFrame();
+		}
+		const float totalMs = std::chrono::duration<float, std::milli>(Profiler::getTime() - startTime).count();
+
+		vertexDataSizes[i] = capture.vertexDataSize;
+		LOG(configs[i].name << ": " << totalMs / frameCount << " ms per frame, " << capture.vertices.size() << " vertices, " 
+				<< capture.vertexDataSize << " vertex bytes, " << capture.indices.size() << " indices, " 
+				<< capture.circles.size() << " circles, " << capture.commands.size() << " commands");
+		passed = checkBenchmarkCapture(configs[i].name, capture, configs[i].expectedCounts) && passed;
+	}
+
+	// Nuklear widgets stay float, so compare whole frames as uploaded
+	LOG("Compact native vertices upload " << 100.0f * (1.0f - (float)vertexDataSizes[2] / vertexDataSizes[1]) 
+			<< "% less vertex data per frame");
+
+	return passed ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) 
 {
 	std::set_terminate(handler);
@@ -367,5 +993,17 @@ int main(int argc, char* argv[])
 	unique_ptr<Profiler::Profiler> profiler = Profiler::Profiler::createProfiler();
 	Profiler::setProfiler(profiler);
 
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--imgui-benchmark") == 0)
+			return runIMGuiBenchmark();
+		if (strcmp(argv[i], "--validate-gl-state") == 0)
+			Graphics::setStateCacheValidation(true);
+		if (strcmp(argv[i], "--render-thread") == 0)
+			s_renderThreadEnabled = true;
+		if (strcmp(argv[i], "--texture-stream-benchmark") == 0)
+			s_textureStreamBenchmarkEnabled = true;
+	}
+
 	return run();
 }